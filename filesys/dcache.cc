@@ -0,0 +1,224 @@
+// dcache.cc
+//	Routines to manage the directory entry cache.
+//
+//	The cache is a fixed number of slots, found through a hash table
+//	on (directory, name) and replaced in LRU order, like the sector
+//	cache in synchdisk.cc.  It only holds what the directories on disk
+//	say, so nothing ever has to be written back; entries are simply
+//	dropped when they might no longer be true.
+//
+//	Entries are keyed by the header sector of the directory they are
+//	in.  When a directory is removed, its header sector may be reused
+//	for another directory, so every entry in it must be purged.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "dcache.h"
+
+#include "copyright.h"
+#include "debug.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// DentryCache::DentryCache
+// 	Initialize an empty dentry cache.
+//----------------------------------------------------------------------
+
+DentryCache::DentryCache() {
+    cache = new Dentry[DcacheSize];
+    for (int i = 0; i < DcacheSize; i++) {
+        cache[i].parent = -1;
+        cache[i].hashNext = NULL;
+        cache[i].lruPrev = (i == 0) ? NULL : &cache[i - 1];
+        cache[i].lruNext = (i == DcacheSize - 1) ? NULL : &cache[i + 1];
+    }
+    for (int i = 0; i < DcacheBuckets; i++)
+        buckets[i] = NULL;
+    lruHead = &cache[0];
+    lruTail = &cache[DcacheSize - 1];
+}
+
+//----------------------------------------------------------------------
+// DentryCache::~DentryCache
+// 	De-allocate the dentry cache.
+//----------------------------------------------------------------------
+
+DentryCache::~DentryCache() {
+    delete[] cache;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Lookup
+// 	Look up "name" in the directory whose header is at "parent".
+//	Return FALSE if the cache does not know; otherwise set "sector"
+//	to the sector of the file's header, or -1 if the directory has
+//	no such name, and "isDir" to whether it is a directory.
+//----------------------------------------------------------------------
+
+bool DentryCache::Lookup(int parent, char *name, int *sector, bool *isDir) {
+    Dentry *entry = Find(parent, name);
+
+    if (entry == NULL) {
+        kernel->stats->numDentryMisses++;
+        return FALSE;
+    }
+    kernel->stats->numDentryHits++;
+    Touch(entry);
+    *sector = entry->sector;
+    *isDir = entry->isDir;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Enter
+// 	Remember that "name" in directory "parent" has its header at
+//	"sector" (-1 if there is no such name), recycling the least
+//	recently used slot if the name is not cached yet.
+//----------------------------------------------------------------------
+
+void DentryCache::Enter(int parent, char *name, int sector, bool isDir) {
+    Dentry *entry = Find(parent, name);
+
+    if (entry == NULL) {
+        int h = Hash(parent, name);
+
+        entry = lruTail;
+        if (entry->parent != -1)
+            Unhash(entry);
+        entry->parent = parent;
+        strncpy(entry->name, name, FileNameMaxLen);
+        entry->name[FileNameMaxLen] = '\0';
+        entry->hashNext = buckets[h];
+        buckets[h] = entry;
+    }
+    entry->sector = sector;
+    entry->isDir = isDir;
+    Touch(entry);
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Invalidate
+// 	Forget "name" in directory "parent", if it is cached.
+//----------------------------------------------------------------------
+
+void DentryCache::Invalidate(int parent, char *name) {
+    Dentry *entry = Find(parent, name);
+
+    if (entry != NULL) {
+        Unhash(entry);
+        MakeLast(entry);
+    }
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Purge
+// 	Forget every name cached for directory "parent".  Called when the
+//	directory is removed.
+//----------------------------------------------------------------------
+
+void DentryCache::Purge(int parent) {
+    for (int i = 0; i < DcacheSize; i++) {
+        if (cache[i].parent == parent) {
+            Unhash(&cache[i]);
+            MakeLast(&cache[i]);
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Clear
+// 	Forget everything.  Called when a whole tree of directories is
+//	removed.
+//----------------------------------------------------------------------
+
+void DentryCache::Clear() {
+    for (int i = 0; i < DcacheSize; i++)
+        cache[i].parent = -1;
+    for (int i = 0; i < DcacheBuckets; i++)
+        buckets[i] = NULL;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Hash
+// 	Return the hash chain for "name" in directory "parent".  Only the
+//	characters that Directory compares are used.
+//----------------------------------------------------------------------
+
+int DentryCache::Hash(int parent, char *name) {
+    unsigned h = parent;
+
+    for (int i = 0; i < FileNameMaxLen && name[i] != '\0'; i++)
+        h = h * 31 + (unsigned char)name[i];
+    return h % DcacheBuckets;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Find
+// 	Return the slot holding "name" in directory "parent", or NULL if
+//	it is not cached.
+//----------------------------------------------------------------------
+
+Dentry *DentryCache::Find(int parent, char *name) {
+    Dentry *entry;
+
+    for (entry = buckets[Hash(parent, name)]; entry != NULL; entry = entry->hashNext)
+        if (entry->parent == parent && !strncmp(entry->name, name, FileNameMaxLen))
+            return entry;
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Unhash
+// 	Take a slot off its hash chain, and mark it unused.
+//----------------------------------------------------------------------
+
+void DentryCache::Unhash(Dentry *entry) {
+    Dentry **prev;
+
+    for (prev = &buckets[Hash(entry->parent, entry->name)]; *prev != entry;
+         prev = &(*prev)->hashNext)
+        ;
+    *prev = entry->hashNext;
+    entry->parent = -1;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Touch
+// 	Move a slot to the front of the LRU list.
+//----------------------------------------------------------------------
+
+void DentryCache::Touch(Dentry *entry) {
+    if (entry == lruHead)
+        return;
+    entry->lruPrev->lruNext = entry->lruNext;
+    if (entry == lruTail)
+        lruTail = entry->lruPrev;
+    else
+        entry->lruNext->lruPrev = entry->lruPrev;
+    entry->lruPrev = NULL;
+    entry->lruNext = lruHead;
+    lruHead->lruPrev = entry;
+    lruHead = entry;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::MakeLast
+// 	Move a slot to the back of the LRU list, so that it is the next
+//	to be recycled.
+//----------------------------------------------------------------------
+
+void DentryCache::MakeLast(Dentry *entry) {
+    if (entry == lruTail)
+        return;
+    entry->lruNext->lruPrev = entry->lruPrev;
+    if (entry == lruHead)
+        lruHead = entry->lruNext;
+    else
+        entry->lruPrev->lruNext = entry->lruNext;
+    entry->lruNext = NULL;
+    entry->lruPrev = lruTail;
+    lruTail->lruNext = entry;
+    lruTail = entry;
+}
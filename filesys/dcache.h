@@ -0,0 +1,83 @@
+// dcache.h
+//	Data structures for the directory entry ("dentry") cache, which
+//	remembers what recently looked up path names resolved to.
+//
+//	Each entry maps a name in a directory, given by the sector of
+//	the directory's file header, to the sector of the named file's
+//	header and whether it is a directory.  A negative entry records
+//	that the name is not there.
+//
+//	We assume mutual exclusion is provided by the caller.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "directory.h"
+
+// Size of the dentry cache.  The number of hash buckets is prime, as
+// for the sector cache.
+const int DcacheSize = 256;     // number of names held in the cache
+const int DcacheBuckets = 127;  // number of hash chains
+
+// The following class defines one slot of the dentry cache.  Each
+// slot is on exactly one hash chain (if it holds a name) and on the
+// LRU list.
+//
+// Internal data structures kept public so that DentryCache can access
+// them directly.
+
+class Dentry {
+   public:
+    int parent;                     // Header sector of the directory,
+                                    //   -1 if the slot is unused
+    char name[FileNameMaxLen + 1];  // Name in that directory
+    int sector;                     // Header sector of the file, or
+                                    //   -1 if there is no such name
+    bool isDir;                     // Is it a directory?
+    Dentry *hashNext;               // Next slot on the same hash chain
+    Dentry *lruPrev;                // Neighbours on the LRU list;
+    Dentry *lruNext;                //   most recently used at the front
+};
+
+// The following class defines the dentry cache.  The file system
+// looks a name up here before reading the directory, and enters
+// what it found (or did not find) afterwards.  Whoever adds a name to
+// a directory, or removes one, must update the cache to match.
+
+class DentryCache {
+   public:
+    DentryCache();   // Initialize an empty cache
+    ~DentryCache();  // De-allocate the cache
+
+    bool Lookup(int parent, char *name, int *sector, bool *isDir);
+    // Return TRUE if "name" in directory
+    // "parent" is cached, setting
+    // "sector" (-1 for a negative entry)
+    // and "isDir"
+    void Enter(int parent, char *name, int sector, bool isDir);
+    // Remember what "name" resolves to
+    void Invalidate(int parent, char *name);  // Forget "name"
+    void Purge(int parent);  // Forget every name in directory "parent"
+    void Clear();            // Forget everything
+
+   private:
+    Dentry *cache;                  // The cache slots
+    Dentry *buckets[DcacheBuckets]; // Hash chains, by parent and name
+    Dentry *lruHead;                // Most recently used slot
+    Dentry *lruTail;                // Least recently used slot
+
+    int Hash(int parent, char *name);      // Hash chain to look on
+    Dentry *Find(int parent, char *name);  // Find a cached name
+    void Unhash(Dentry *entry);  // Take a slot off its chain; it
+                                 // becomes unused
+    void Touch(Dentry *entry);   // Move to the LRU front
+    void MakeLast(Dentry *entry);  // Move to the LRU back
+};
+
+#endif  // DCACHE_H
@@ -11,9 +11,27 @@
 //	we use ReadFrom/WriteBack to fetch the contents of the directory
 //	from disk, and to write back any modifications back to disk.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
+//	On disk, the table is split into buckets of one sector each, and
+//	a name is kept in the bucket its hash value selects; the first
+//	sector of the file records how many buckets there are.  A bucket
+//	with more names than fit in a sector links to overflow pages,
+//	which are kept together after the last bucket.  Looking up, adding
+//	or removing a name reads the header and the pages of that one
+//	bucket, however big the directory is, and usually writes only one
+//	of them.  Nothing on disk counts the names, so that adding one does
+//	not change a second sector.
+//
+//	When a name does not fit in its bucket, it goes in a new overflow
+//	page.  How full the directory is as a whole is measured by how many
+//	overflow pages there are for its buckets; while there are too many,
+//	each Add splits the next bucket in turn: into itself and a new
+//	bucket, after the last one (linear hashing).  The overflow page that
+//	was there moves to the end of the file.  Once all have been split,
+//	the number of buckets has doubled and the next round starts.  So
+//	an Add splits at most one bucket, and the directory grows a sector
+//	at a time, as long as the file system has room for it.  Overflow
+//	pages that become empty are given back, by moving the last one
+//	into their place.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -22,9 +40,18 @@
 #include "directory.h"
 
 #include "copyright.h"
+#include "debug.h"
 #include "filehdr.h"
+#include "inode.h"
+#include "main.h"
+#include "pool.h"
 #include "utility.h"
 
+// A directory, and the pages of it that have been read in, last only
+// as long as one lookup or change, so they are kept in pools.
+static Pool directoryPool("directories", sizeof(Directory), 8);
+static Pool bucketPool("directory buckets", sizeof(DirBucket), 16);
+
 //----------------------------------------------------------------------
 // Directory::Directory
 // 	Initialize a directory; initially, the directory is completely
@@ -32,18 +59,18 @@
 //	is all we need, but otherwise, we need to call FetchFrom in order
 //	to initialize it from disk.
 //
-//	"size" is the number of entries in the directory
+//	"size" is the number of entries the directory starts out with
+//	room for
 //----------------------------------------------------------------------
 
 Directory::Directory(int size) {
-    table = new DirectoryEntry[size];
-
-    // MP4 mod tag
-    memset(table, 0, sizeof(DirectoryEntry) * size);  // dummy operation to keep valgrind happy
-
-    tableSize = size;
-    for (int i = 0; i < tableSize; i++)
-        table[i].inUse = FALSE;
+    numBuckets = max(1, divRoundUp(size, DirBucketEntries));
+    baseBuckets = numBuckets;
+    numOverflow = 0;
+    file = NULL;
+    diskPages = 0;  // every page is new
+    headerDirty = TRUE;
+    pages = new ::List<DirBucket *>;
 }
 
 //----------------------------------------------------------------------
@@ -52,44 +79,150 @@ Directory::Directory(int size) {
 //----------------------------------------------------------------------
 
 Directory::~Directory() {
-    delete[] table;
+    DropPages();
+    delete pages;
+}
+
+//----------------------------------------------------------------------
+// Directory::operator new
+// Directory::operator delete
+// 	Get a directory from the pool of them, and put it back.
+//----------------------------------------------------------------------
+
+void *Directory::operator new(size_t size) {
+    ASSERT(size == sizeof(Directory));
+    return directoryPool.Get();
+}
+
+void Directory::operator delete(void *object) {
+    directoryPool.Put(object);
+}
+
+//----------------------------------------------------------------------
+// DirBucket::operator new
+// DirBucket::operator delete
+// 	Get a page from the pool of them, and put it back.
+//----------------------------------------------------------------------
+
+void *DirBucket::operator new(size_t size) {
+    ASSERT(size == sizeof(DirBucket));
+    return bucketPool.Get();
+}
+
+void DirBucket::operator delete(void *object) {
+    bucketPool.Put(object);
 }
 
 //----------------------------------------------------------------------
 // Directory::FetchFrom
-// 	Read the contents of the directory from disk.
+// 	Read the header of the directory from disk.  Pages are read
+//	when they are needed.  If "file" does not hold a directory, it
+//	is treated as an empty one that cannot be added to.
 //
 //	"file" -- file containing the directory contents
 //----------------------------------------------------------------------
 
 void Directory::FetchFrom(OpenFile *file) {
-    (void)file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    int header[SectorSize / sizeof(int)];
+
+    DropPages();
+    this->file = file;
+    headerDirty = FALSE;
+    (void)file->ReadAt((char *)header, SectorSize, 0);
+    numBuckets = header[1];
+    baseBuckets = header[2];
+    numOverflow = header[3];
+    if (header[0] != DirectoryMagic || baseBuckets < 1 || numBuckets < baseBuckets ||
+        numBuckets >= 2 * baseBuckets || numOverflow < 0 ||
+        NumPages() > MaxDirPages || file->Length() < FileLength()) {
+        DEBUG(dbgFile, "Not a directory");
+        numBuckets = 0;
+        baseBuckets = 1;
+        numOverflow = 0;
+    }
+    diskPages = NumPages();
 }
 
 //----------------------------------------------------------------------
 // Directory::WriteBack
-// 	Write any modifications to the directory back to disk
+// 	Write the pages that changed, and the header, back to disk.
+//	The file must already be FileLength() bytes long.  Pages given
+//	back past the end are not written.
 //
 //	"file" -- file to contain the new directory contents
 //----------------------------------------------------------------------
 
 void Directory::WriteBack(OpenFile *file) {
-    (void)file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    char buf[SectorSize];
+
+    ASSERT(file->Length() >= FileLength());
+    for (int i = diskPages; i < NumPages(); i++)
+        (void)Page(i);
+
+    for (ListIterator<DirBucket *> iter(pages); !iter.IsDone(); iter.Next()) {
+        DirBucket *page = iter.Item();
+        if (page->dirty && page->number < NumPages()) {
+            int *links = (int *)&buf[SectorSize - 2 * sizeof(int)];
+            memset(buf, 0, SectorSize);
+            bcopy((char *)page->entries, buf, sizeof(page->entries));
+            links[0] = page->next;
+            links[1] = page->owner;
+            (void)file->WriteAt(buf, SectorSize, (1 + page->number) * SectorSize);
+            page->dirty = FALSE;
+        }
+    }
+    if (headerDirty) {
+        int *header = (int *)buf;
+        memset(buf, 0, SectorSize);
+        header[0] = DirectoryMagic;
+        header[1] = numBuckets;
+        header[2] = baseBuckets;
+        header[3] = numOverflow;
+        (void)file->WriteAt(buf, SectorSize, 0);
+        headerDirty = FALSE;
+    }
+    this->file = file;
+    diskPages = NumPages();
+}
+
+//----------------------------------------------------------------------
+// Directory::FileLength
+// 	Return how long the directory file must be to hold every page.
+//----------------------------------------------------------------------
+
+int Directory::FileLength() {
+    return (1 + NumPages()) * SectorSize;
 }
 
 //----------------------------------------------------------------------
-// Directory::FindIndex
-// 	Look up file name in directory, and return its location in the table of
-//	directory entries.  Return -1 if the name isn't in the directory.
+// Directory::FindEntry
+// 	Look up file name in directory, and return its entry (in the
+//	in-core copy of its page).  Return NULL if the name isn't in the
+//	directory.
 //
 //	"name" -- the file name to look up
+//	"page" -- if not NULL, set to the page holding the entry
 //----------------------------------------------------------------------
 
-int Directory::FindIndex(char *name) {
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen))
-            return i;
-    return -1;  // name not in directory
+DirectoryEntry *Directory::FindEntry(char *name, DirBucket **page) {
+    DirBucket *p;
+    int number;
+
+    if (numBuckets == 0)
+        return NULL;
+    number = BucketOf(name);
+    do {
+        p = Page(number);
+        for (int i = 0; i < DirBucketEntries; i++) {
+            if (p->entries[i].inUse && !strncmp(p->entries[i].name, name, FileNameMaxLen)) {
+                if (page != NULL)
+                    *page = p;
+                return &p->entries[i];
+            }
+        }
+        number = p->next;
+    } while (number != 0);
+    return NULL;  // name not in directory
 }
 
 //----------------------------------------------------------------------
@@ -102,18 +235,18 @@ int Directory::FindIndex(char *name) {
 //----------------------------------------------------------------------
 
 int Directory::Find(char *name) {
-    int i = FindIndex(name);
+    DirectoryEntry *entry = FindEntry(name, NULL);
 
-    if (i != -1)
-        return table[i].sector;
+    if (entry != NULL)
+        return entry->sector;
     return -1;
 }
 
 bool Directory::IsDir(char *name) {
-    int i = FindIndex(name);
+    DirectoryEntry *entry = FindEntry(name, NULL);
 
-    if (i != -1)
-        return table[i].isDir;
+    if (entry != NULL)
+        return entry->isDir;
     return FALSE;
 }
 
@@ -121,114 +254,176 @@ bool Directory::IsDir(char *name) {
 // Directory::Add
 // 	Add a file into the directory.  Return TRUE if successful;
 //	return FALSE if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
-//	additional file names.
+//	the directory cannot grow any more.
 //
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
 //----------------------------------------------------------------------
 
 bool Directory::Add(char *name, int newSector) {
-    if (FindIndex(name) != -1)
-        return FALSE;
-
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse) {
-            table[i].inUse = TRUE;
-            table[i].isDir = FALSE;
-            strncpy(table[i].name, name, FileNameMaxLen);
-            table[i].sector = newSector;
-            return TRUE;
-        }
-    return FALSE;  // no space.  Fix when we have extensible files.
+    return AddEntry(name, newSector, FALSE);
 }
 
 // MP4 start
 bool Directory::AddDirectory(char *name, int newSector) {
-    if (FindIndex(name) != -1)
+    return AddEntry(name, newSector, TRUE);
+}
+// MP4 end
+
+//----------------------------------------------------------------------
+// Directory::AddEntry
+// 	Put a file or directory in the bucket for its name.  If there
+//	are too many overflow pages, split the next bucket in turn.  Return
+//	FALSE if the name is already in the directory, or there are
+//	already MaxDirPages pages.
+//
+//	"name" -- the name of the file being added
+//	"newSector" -- the disk sector containing the added file's header
+//	"isDir" -- is it a directory?
+//----------------------------------------------------------------------
+
+bool Directory::AddEntry(char *name, int newSector, bool isDir) {
+    DirectoryEntry *entry;
+    DirBucket *page;
+
+    if (numBuckets == 0 || FindEntry(name, NULL) != NULL)
         return FALSE;
+    entry = FreeEntry(BucketOf(name), &page);
+    if (entry == NULL)
+        return FALSE;  // no space
+
+    entry->inUse = TRUE;
+    entry->isDir = isDir;
+    strncpy(entry->name, name, FileNameMaxLen);
+    entry->sector = newSector;
+    page->dirty = TRUE;
+
+    if (numOverflow * DirSplitRatio > numBuckets && NumPages() < MaxDirPages)
+        Split();  // the directory is getting full
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::FreeEntry
+// 	Return an unused entry in the pages of a bucket, adding an
+//	overflow page to the bucket if they are all in use.  Return NULL
+//	if there are already MaxDirPages pages.
+//
+//	"bucket" -- the bucket to look in
+//	"page" -- set to the page holding the entry
+//----------------------------------------------------------------------
 
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse) {
-            table[i].inUse = TRUE;
-            table[i].isDir = TRUE;
-            strncpy(table[i].name, name, FileNameMaxLen);
-            table[i].sector = newSector;
-            return TRUE;
+DirectoryEntry *Directory::FreeEntry(int bucket, DirBucket **page) {
+    DirBucket *p = Page(bucket);
+
+    for (;;) {
+        for (int i = 0; i < DirBucketEntries; i++) {
+            if (!p->entries[i].inUse) {
+                *page = p;
+                return &p->entries[i];
+            }
         }
-    return FALSE;
+        if (p->next == 0)
+            break;
+        p = Page(p->next);
+    }
+    if (NumPages() == MaxDirPages)
+        return NULL;
+
+    numOverflow++;
+    headerDirty = TRUE;
+    p->next = NumPages() - 1;
+    p->dirty = TRUE;
+    *page = EmptyPage(p->next, bucket);
+    return &(*page)->entries[0];
 }
-// MP4 end
 
 //----------------------------------------------------------------------
 // Directory::Remove
 // 	Remove a file name from the directory.  Return TRUE if successful;
-//	return FALSE if the file isn't in the directory.
+//	return FALSE if the file isn't in the directory.  An overflow page
+//	left empty is given back, but buckets are never merged.
 //
 //	"name" -- the file name to be removed
 //----------------------------------------------------------------------
 
 bool Directory::Remove(char *name) {
-    int i = FindIndex(name);
+    DirBucket *page;
+    DirectoryEntry *entry = FindEntry(name, &page);
 
-    if (i == -1)
+    if (entry == NULL)
         return FALSE;  // name not in directory
-    table[i].inUse = FALSE;
+    entry->inUse = FALSE;
+    page->dirty = TRUE;
+
+    if (page->number >= numBuckets) {
+        for (int i = 0; i < DirBucketEntries; i++)
+            if (page->entries[i].inUse)
+                return TRUE;
+        FreePage(page);
+    }
     return TRUE;
 }
 
 void Directory::RecursiveRemove(PersistentBitmap *freeMap) {
-    Directory *directory = new Directory(tableSize);
+    Directory *directory = new Directory(0);
+    DirectoryEntry entries[DirBucketEntries];
+    Inode *inode;
     OpenFile *dirFile;
-    FileHeader *fileHdr = new FileHeader;
-    bool success = FALSE;
 
-    for (int i = 0; i < tableSize; i++) {
-        if (table[i].inUse) {
-            if (table[i].isDir) {
-                dirFile = new OpenFile(table[i].sector);
+    for (int p = 0; p < NumPages(); p++) {
+        ReadPage(p, entries);
+        for (int i = 0; i < DirBucketEntries; i++) {
+            if (entries[i].inUse && entries[i].isDir) {
+                dirFile = new OpenFile(entries[i].sector);
                 directory->FetchFrom(dirFile);
                 directory->RecursiveRemove(freeMap);
 
-                fileHdr->FetchFrom(table[i].sector);
-                fileHdr->Deallocate(freeMap);
-                freeMap->Clear(table[i].sector);
-                fileHdr->WriteBack(table[i].sector);
-                freeMap->WriteBack(dirFile);
+                inode = kernel->inodeTable->Get(entries[i].sector);  // dirFile's
+                inode->hdr->Deallocate(freeMap);
+                freeMap->Clear(entries[i].sector);
+                kernel->inodeTable->Release(inode);
                 delete dirFile;
+                kernel->inodeTable->Forget(entries[i].sector);
             }
-            table[i].inUse = FALSE;
         }
     }
-    delete fileHdr;
     delete directory;
 }
 
 //----------------------------------------------------------------------
 // Directory::List
-// 	List all the file names in the directory.
+// 	List all the file names in the directory, page by page.
 //----------------------------------------------------------------------
 
 void Directory::List() {
-    for (int i = 0; i < tableSize; i++) {
-        if (table[i].inUse)
-            printf("%s\n", table[i].name);
+    DirectoryEntry entries[DirBucketEntries];
+
+    for (int p = 0; p < NumPages(); p++) {
+        ReadPage(p, entries);
+        for (int i = 0; i < DirBucketEntries; i++)
+            if (entries[i].inUse)
+                printf("%s\n", entries[i].name);
     }
 }
 
 void Directory::RecursiveList(int indents) {
-    Directory *directory = new Directory(tableSize);
+    Directory *directory = new Directory(0);
+    DirectoryEntry entries[DirBucketEntries];
     OpenFile *dirFile;
 
-    for (int i = 0; i < tableSize; i++) {
-        if (table[i].inUse) {
+    for (int p = 0; p < NumPages(); p++) {
+        ReadPage(p, entries);
+        for (int i = 0; i < DirBucketEntries; i++) {
+            if (!entries[i].inUse)
+                continue;
             for (int j = 0; j < indents; j++) {
                 printf("  ");
             }
-            printf("[%c] %s\n", table[i].isDir ? 'D' : 'F', table[i].name);
+            printf("[%c] %s\n", entries[i].isDir ? 'D' : 'F', entries[i].name);
 
-            if (table[i].isDir) {
-                dirFile = new OpenFile(table[i].sector);
+            if (entries[i].isDir) {
+                dirFile = new OpenFile(entries[i].sector);
                 directory->FetchFrom(dirFile);
                 directory->RecursiveList(indents + 1);
                 delete dirFile;
@@ -238,6 +433,43 @@ void Directory::RecursiveList(int indents) {
     delete directory;
 }
 
+//----------------------------------------------------------------------
+// Directory::PrintSpread
+// 	List the files in the directory and in every directory below it,
+//	like RecursiveList, along with how each one is spread over the
+//	tracks of the disk.
+//----------------------------------------------------------------------
+
+void Directory::PrintSpread(int indents) {
+    Directory *directory = new Directory(0);
+    DirectoryEntry entries[DirBucketEntries];
+    OpenFile *dirFile;
+    Inode *inode;
+
+    for (int p = 0; p < NumPages(); p++) {
+        ReadPage(p, entries);
+        for (int i = 0; i < DirBucketEntries; i++) {
+            if (!entries[i].inUse)
+                continue;
+            for (int j = 0; j < indents; j++) {
+                printf("  ");
+            }
+            printf("[%c] %s: ", entries[i].isDir ? 'D' : 'F', entries[i].name);
+            inode = kernel->inodeTable->Get(entries[i].sector);
+            inode->hdr->PrintSpread();
+            kernel->inodeTable->Release(inode);
+
+            if (entries[i].isDir) {
+                dirFile = new OpenFile(entries[i].sector);
+                directory->FetchFrom(dirFile);
+                directory->PrintSpread(indents + 1);
+                delete dirFile;
+            }
+        }
+    }
+    delete directory;
+}
+
 //----------------------------------------------------------------------
 // Directory::Print
 // 	List all the file names in the directory, their FileHeader locations,
@@ -245,25 +477,262 @@ void Directory::RecursiveList(int indents) {
 //----------------------------------------------------------------------
 
 void Directory::Print() {
-    FileHeader *hdr = new FileHeader;
-    Directory *directory = new Directory(tableSize);
+    Inode *inode;
+    Directory *directory = new Directory(0);
+    DirectoryEntry entries[DirBucketEntries];
     OpenFile *dirFile;
 
-    printf("Directory contents:\n");
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse) {
-            printf("Name: %s, Sector: %d\n", table[i].name, table[i].sector);
-            hdr->FetchFrom(table[i].sector);
-            hdr->Print();
-
-            if (table[i].isDir) {
-                dirFile = new OpenFile(table[i].sector);
+    printf("Directory contents: %d buckets, %d overflow pages\n", numBuckets, numOverflow);
+    for (int p = 0; p < NumPages(); p++) {
+        ReadPage(p, entries);
+        for (int i = 0; i < DirBucketEntries; i++) {
+            if (!entries[i].inUse)
+                continue;
+            printf("Name: %s, Sector: %d\n", entries[i].name, entries[i].sector);
+            inode = kernel->inodeTable->Get(entries[i].sector);
+            inode->hdr->Print();
+            kernel->inodeTable->Release(inode);
+
+            if (entries[i].isDir) {
+                dirFile = new OpenFile(entries[i].sector);
                 directory->FetchFrom(dirFile);
                 directory->Print();
                 delete dirFile;
             }
         }
+    }
     printf("\n");
     delete directory;
-    delete hdr;
+}
+
+//----------------------------------------------------------------------
+// Directory::Hash
+// 	Return the hash value of a name.  Only the characters that
+//	FindEntry compares are used.
+//
+//	"name" -- the file name
+//----------------------------------------------------------------------
+
+unsigned Directory::Hash(char *name) {
+    unsigned h = 0;
+
+    for (int i = 0; i < FileNameMaxLen && name[i] != '\0'; i++)
+        h = h * 31 + (unsigned char)name[i];
+    return h;
+}
+
+//----------------------------------------------------------------------
+// Directory::BucketOf
+// 	Return the bucket "name" belongs in.  Buckets that have already
+//	been split this round hash with twice as many buckets.
+//
+//	"name" -- the file name
+//----------------------------------------------------------------------
+
+int Directory::BucketOf(char *name) {
+    unsigned h = Hash(name);
+    int b = h % baseBuckets;
+
+    if (b < numBuckets - baseBuckets)
+        b = h % (2 * baseBuckets);
+    return b;
+}
+
+//----------------------------------------------------------------------
+// Directory::Page
+// 	Return page "number", reading it in from disk the first time.
+//	A page that is not in the file yet starts out as an empty bucket
+//	(and dirty).
+//----------------------------------------------------------------------
+
+DirBucket *Directory::Page(int number) {
+    ListIterator<DirBucket *> iter(pages);
+    DirBucket *page;
+    char buf[SectorSize];
+
+    ASSERT(number >= 0 && number < NumPages());
+    for (; !iter.IsDone(); iter.Next())
+        if (iter.Item()->number == number)
+            return iter.Item();
+
+    if (number >= diskPages)
+        return EmptyPage(number, number);
+    page = new DirBucket;
+    page->number = number;
+    (void)file->ReadAt(buf, SectorSize, (1 + number) * SectorSize);
+    bcopy(buf, (char *)page->entries, sizeof(page->entries));
+    page->next = ((int *)&buf[SectorSize - 2 * sizeof(int)])[0];
+    page->owner = ((int *)&buf[SectorSize - 2 * sizeof(int)])[1];
+    page->dirty = FALSE;
+    pages->Append(page);
+    return page;
+}
+
+//----------------------------------------------------------------------
+// Directory::EmptyPage
+// 	Return page "number", emptied out (and dirty), without reading
+//	what was there before.
+//
+//	"owner" -- the bucket it is to be a page of
+//----------------------------------------------------------------------
+
+DirBucket *Directory::EmptyPage(int number, int owner) {
+    ListIterator<DirBucket *> iter(pages);
+    DirBucket *page = NULL;
+
+    ASSERT(number >= 0 && number < NumPages());
+    for (; !iter.IsDone() && page == NULL; iter.Next())
+        if (iter.Item()->number == number)
+            page = iter.Item();
+    if (page == NULL) {
+        page = new DirBucket;
+        page->number = number;
+        pages->Append(page);
+    }
+    memset(page->entries, 0, sizeof(page->entries));
+    page->next = 0;
+    page->owner = owner;
+    page->dirty = TRUE;
+    return page;
+}
+
+//----------------------------------------------------------------------
+// Directory::ReadPage
+// 	Copy the entries of page "number" into "into", from memory if
+//	it has been read in, or else from disk.  Used to walk through
+//	every page without keeping them all in memory.
+//----------------------------------------------------------------------
+
+void Directory::ReadPage(int number, DirectoryEntry *into) {
+    char buf[SectorSize];
+    ListIterator<DirBucket *> iter(pages);
+
+    for (; !iter.IsDone(); iter.Next()) {
+        if (iter.Item()->number == number) {
+            bcopy((char *)iter.Item()->entries, (char *)into, sizeof(iter.Item()->entries));
+            return;
+        }
+    }
+    ASSERT(number < diskPages);
+    (void)file->ReadAt(buf, SectorSize, (1 + number) * SectorSize);
+    bcopy(buf, (char *)into, DirBucketEntries * sizeof(DirectoryEntry));
+}
+
+//----------------------------------------------------------------------
+// Directory::DropPages
+// 	Forget every page read in, along with any changes to them.
+//----------------------------------------------------------------------
+
+void Directory::DropPages() {
+    while (!pages->IsEmpty())
+        delete pages->RemoveFront();
+}
+
+//----------------------------------------------------------------------
+// Directory::Previous
+// 	Return the page that links to overflow page "page": the bucket
+//	it belongs to, or another of its overflow pages.
+//----------------------------------------------------------------------
+
+DirBucket *Directory::Previous(DirBucket *page) {
+    DirBucket *p = Page(page->owner);
+
+    while (p->next != page->number) {
+        ASSERT(p->next != 0);
+        p = Page(p->next);
+    }
+    return p;
+}
+
+//----------------------------------------------------------------------
+// Directory::MovePage
+// 	Move overflow page "from" to page "to", which is not in use, and
+//	fix up the link to it.
+//----------------------------------------------------------------------
+
+void Directory::MovePage(int from, int to) {
+    DirBucket *old = Page(from);
+    DirBucket *prev = Previous(old);
+    DirBucket *page = EmptyPage(to, old->owner);
+
+    bcopy((char *)old->entries, (char *)page->entries, sizeof(old->entries));
+    page->next = old->next;
+    prev->next = to;
+    prev->dirty = TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::FreePage
+// 	Unlink an empty overflow page from its bucket, and give it back.
+//	The last page moves into its place, so the overflow pages stay
+//	together at the end of the file.
+//----------------------------------------------------------------------
+
+void Directory::FreePage(DirBucket *page) {
+    DirBucket *prev = Previous(page);
+    int last = NumPages() - 1;
+
+    ASSERT(page->number >= numBuckets);
+    prev->next = page->next;
+    prev->dirty = TRUE;
+    if (page->number != last)
+        MovePage(last, page->number);
+    numOverflow--;
+    headerDirty = TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::Split
+// 	Split the next bucket in turn: add a bucket after the last one,
+//	moving the overflow page there to the end, and move to it the
+//	entries that now hash there.  The bucket split is packed into as
+//	few pages as its entries need.
+//----------------------------------------------------------------------
+
+void Directory::Split() {
+    int from = numBuckets - baseBuckets;
+    int image = numBuckets;
+    int count = 0, size = 0;
+    DirectoryEntry *moving;
+    DirectoryEntry *entry;
+    DirBucket *page;
+
+    DEBUG(dbgFile, "Splitting directory bucket " << from << " into " << image);
+    numBuckets++;
+    if (numOverflow > 0)
+        MovePage(image, NumPages() - 1);
+    (void)EmptyPage(image, image);
+
+    for (page = Page(from); ; page = Page(page->next)) {
+        size += DirBucketEntries;
+        if (page->next == 0)
+            break;
+    }
+    moving = new DirectoryEntry[size];
+    for (page = Page(from); ; page = Page(page->next)) {
+        for (int i = 0; i < DirBucketEntries; i++) {
+            if (page->entries[i].inUse) {
+                moving[count++] = page->entries[i];
+                page->entries[i].inUse = FALSE;
+            }
+        }
+        page->dirty = TRUE;
+        if (page->next == 0)
+            break;
+    }
+    while ((page = Page(from))->next != 0)
+        FreePage(Page(page->next));
+
+    for (int i = 0; i < count; i++) {
+        bool stays = Hash(moving[i].name) % (2 * baseBuckets) == (unsigned)from;
+        entry = FreeEntry(stays ? from : image, &page);
+        ASSERT(entry != NULL);
+        *entry = moving[i];
+        page->dirty = TRUE;
+    }
+    delete[] moving;
+
+    if (numBuckets == 2 * baseBuckets)
+        baseBuckets *= 2;  // every bucket has been split; next round
+    headerDirty = TRUE;
 }
@@ -17,6 +17,8 @@
 #ifndef DIRECTORY_H
 #define DIRECTORY_H
 
+#include "disk.h"
+#include "list.h"
 #include "openfile.h"
 #include "pbitmap.h"
 
@@ -42,6 +44,34 @@ class DirectoryEntry {
 };
 // MP4 end
 
+// A directory file is a header sector followed by hash buckets, one
+// sector each, and then the overflow sectors of buckets that have more
+// names than fit in one.  The sectors after the header are numbered from
+// 0 as pages: bucket b is page b, and the overflow pages come after the
+// last bucket.  Buckets are split one at a time (linear hashing), while
+// there is more than one overflow page for every DirSplitRatio buckets.
+const int DirBucketEntries = ((SectorSize - 2 * sizeof(int)) / sizeof(DirectoryEntry));
+const int DirSplitRatio = 4;            // buckets per overflow page
+const int MaxDirPages = (1 << 16);      // the most a directory can have
+const int DirectoryMagic = 0x44697231;  // marks the header sector
+
+// The following class defines one page of a directory -- a bucket, or
+// an overflow page of one -- as read into memory.  On disk, the links
+// are kept after the entries.
+
+class DirBucket {
+   public:
+    static void *operator new(size_t size);  // From a pool of them
+    static void operator delete(void *object);
+
+    int number;                                // Which page this is
+    bool dirty;                                // Changed since read?
+    DirectoryEntry entries[DirBucketEntries];  // The entries
+    int next;                                  // Next page of the same
+                                               // bucket, or 0 if none
+    int owner;                                 // The bucket it is a page of
+};
+
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
@@ -50,18 +80,28 @@ class DirectoryEntry {
 //
 // The constructor initializes a directory structure in memory; the
 // FetchFrom/WriteBack operations shuffle the directory information
-// from/to disk.
+// from/to disk.  FetchFrom only reads the header sector; the pages of
+// the bucket a name hashes to are read when the name is looked up, and
+// WriteBack only writes the sectors that changed.  Before WriteBack, the
+// caller must make the file FileLength() bytes long, since an Add may
+// have added pages.
 
 class Directory {
    public:
     Directory(int size);  // Initialize an empty directory
-                          // with space for "size" files
+                          // with space for "size" files;
+                          // it can grow past that
     ~Directory();         // De-allocate the directory
 
+    static void *operator new(size_t size);  // From a pool of them
+    static void operator delete(void *object);
+
     void FetchFrom(OpenFile *file);  // Init directory contents from disk
     void WriteBack(OpenFile *file);  // Write modifications to
                                      // directory contents back to disk
 
+    int FileLength();  // Bytes the directory file must have
+
     int Find(char *name);  // Find the sector number of the
                            // FileHeader for file: "name"
 
@@ -82,21 +122,48 @@ class Directory {
     void RecursiveRemove(PersistentBitmap *freeMap);
 
     void RecursiveList(int indents);
+    void PrintSpread(int indents);  // Same, with the tracks each
+                                    // file is on
 
    private:
     /*
                 MP4 Hint:
                 Directory is actually a "file", be careful of how it works with OpenFile and FileHdr.
-                Disk part: table
-                In-core part: tableSize
+                Disk part: numBuckets, baseBuckets, numOverflow, and the pages
+                In-core part: the rest
         */
 
-    int tableSize;          // Number of directory entries
-    DirectoryEntry *table;  // Table of pairs:
-                            // <file name, file header location>
-
-    int FindIndex(char *name);  // Find the index into the directory
-                                //  table corresponding to "name"
+    int numBuckets;   // Number of buckets
+    int baseBuckets;  // Buckets at the start of this round of
+                      // splits; bucket numBuckets - baseBuckets
+                      // is the next to be split
+    int numOverflow;  // Number of overflow pages
+
+    OpenFile *file;              // Where the pages are read from
+    int diskPages;               // How many of them are in the file
+    bool headerDirty;            // Header sector changed?
+    ::List<DirBucket *> *pages;  // Pages read in (or made) so far
+
+    int NumPages() { return numBuckets + numOverflow; }
+    unsigned Hash(char *name);            // Hash value of "name"
+    int BucketOf(char *name);             // Bucket "name" belongs in
+    DirBucket *Page(int number);          // Read in a page, if need be
+    DirBucket *EmptyPage(int number, int owner);
+    // Clear a page, without reading it
+    void ReadPage(int number, DirectoryEntry *into);
+    // Copy of a page, not kept in memory
+    void DropPages();                     // Forget the pages read in
+
+    DirectoryEntry *FindEntry(char *name, DirBucket **page);
+    // Find the entry for "name"
+    DirectoryEntry *FreeEntry(int bucket, DirBucket **page);
+    // Find room in a bucket
+    bool AddEntry(char *name, int newSector, bool isDir);
+    // Add a file or directory
+    DirBucket *Previous(DirBucket *page);  // The page linking to "page"
+    void MovePage(int from, int to);       // Move an overflow page
+    void FreePage(DirBucket *page);        // Give back an overflow page
+    void Split();                          // Split the next bucket
 };
 
 #endif  // DIRECTORY_H
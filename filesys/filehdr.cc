@@ -10,6 +10,27 @@
 //	blocks). The table size is chosen so that the file header
 //	will be just big enough to fit in one disk sector,
 //
+//	Where possible the data is allocated in a few contiguous runs
+//	instead, and the header records (start, length) extents; a
+//	mostly contiguous file of any size is then described by its
+//	header sector alone.
+//
+//	Parts of a file that have never been written need no sectors at
+//	all: they are holes, which read as zeros, and get sectors the
+//	first time they are written (see Fill).
+//
+//	A file of at most MaxInlineBytes needs no data sectors either: its
+//	bytes are kept in the header sector, in place of the pointers,
+//	until it grows too big for that.
+//
+//	Data is allocated a block of sectorsPerBlock sectors at a time;
+//	pointers point to the first sector of a block, and extents are a
+//	whole number of blocks long.
+//
+//	A MapCursor looks offsets up for an open file in a copy of part
+//	of the map, so that reading a big file does not walk down the
+//	index blocks for every request.
+//
 //      Unlike in a real system, we do not keep track of file permissions,
 //	ownership, last modification date, etc., in the file header.
 //
@@ -27,9 +48,83 @@
 #include "copyright.h"
 #include "debug.h"
 #include "main.h"
+#include "pool.h"
 #include "synchdisk.h"
 
-IndexBlock::IndexBlock(int level) : level(level) {
+// How file data is laid out on the disk mounted, as SetBlockSize
+// sets it: the sectors in a data block, the bytes of the file a
+// pointer maps at each level, and the most a file can hold.
+static int sectorsPerBlock = 1;
+static int sizePerPointer[4] = {SectorSize, NumSectorInt * SectorSize,
+                                NumSectorInt * NumSectorInt * SectorSize,
+                                NumSectorInt * NumSectorInt * NumSectorInt * SectorSize};
+static int maxFileSize = NumPointers * NumSectorInt * NumSectorInt * NumSectorInt * SectorSize;
+
+// Headers, index blocks, the tables of their children, and map cursors
+// come and go with every file opened, so they are kept in pools rather
+// than handed back to the host allocator.  A header's table has
+// NumPointers entries and an index block's NumSectorInt; they share a
+// pool of the larger.
+static Pool headerPool("file headers", sizeof(FileHeader), 32);
+static Pool indexBlockPool("index blocks", sizeof(IndexBlock), 64);
+static Pool childTablePool("index block tables", NumSectorInt * sizeof(IndexBlock *), 32);
+static Pool cursorPool("map cursors", sizeof(MapCursor), 32);
+
+//----------------------------------------------------------------------
+// BlockToSector
+// 	Return the sector holding byte "offset" of the data mapped by
+//	"blocks", pointers to data blocks, or HoleSector if it is in a
+//	hole.
+//----------------------------------------------------------------------
+
+static int BlockToSector(int *blocks, int offset) {
+    int block = blocks[offset / sizePerPointer[0]];
+
+    if (block == HoleSector)
+        return HoleSector;
+    return block + (offset % sizePerPointer[0]) / SectorSize;
+}
+
+//----------------------------------------------------------------------
+// BlockRun
+// 	Like BlockToSector, but also set "*runLength" to the number of
+//	sectors from there on (at most "maxSectors") that are next to
+//	each other on disk, or are holes like it, going on into the
+//	following blocks, up to the "count"th.
+//----------------------------------------------------------------------
+
+static int BlockRun(int *blocks, int count, int offset, int maxSectors, int *runLength) {
+    int i = offset / sizePerPointer[0];
+    int first = BlockToSector(blocks, offset);
+
+    *runLength = sectorsPerBlock - (offset % sizePerPointer[0]) / SectorSize;
+    while (*runLength < maxSectors && ++i < count) {
+        if (first == HoleSector ? blocks[i] != HoleSector : blocks[i] != first + *runLength)
+            break;
+        *runLength += sectorsPerBlock;
+    }
+    *runLength = min(*runLength, maxSectors);
+    return first;
+}
+
+//----------------------------------------------------------------------
+// RunFree
+// 	Return TRUE if the "length" sectors from "start" on are all free.
+//----------------------------------------------------------------------
+
+static bool RunFree(PersistentBitmap *freeMap, int start, int length) {
+    for (int i = 0; i < length; i++)
+        if (freeMap->Test(start + i))
+            return FALSE;
+    return TRUE;
+}
+
+IndexBlock *IndexBlock::lruHead = NULL;
+IndexBlock *IndexBlock::lruTail = NULL;
+int IndexBlock::numInCore = 0;
+
+IndexBlock::IndexBlock(int level, IndexBlock *parent, IndexBlock **slot)
+    : level(level), parent(parent), slot(slot) {
     // if (debug->IsEnabled('f'))
     //     printf("IndexBlock::IndexBlock(%d)\n", level);
 
@@ -38,6 +133,21 @@ IndexBlock::IndexBlock(int level) : level(level) {
     levelSectors = -1;
     memset(nextSectors, -1, sizeof(nextSectors));
     nextIndexBlocks = NULL;
+    if (level != 0) {
+        nextIndexBlocks = (IndexBlock **)childTablePool.Get();
+        memset(nextIndexBlocks, 0, sizeof(IndexBlock *) * NumSectorInt);
+    }
+    dirty = FALSE;
+
+    lruPrev = NULL;  // start out at the front of the list,
+    lruNext = lruHead;  // behind our ancestors
+    if (lruHead != NULL)
+        lruHead->lruPrev = this;
+    else
+        lruTail = this;
+    lruHead = this;
+    numInCore++;
+    Touch();
 }
 IndexBlock::~IndexBlock() {
     // if (debug->IsEnabled('f'))
@@ -45,58 +155,137 @@ IndexBlock::~IndexBlock() {
 
     if (level != 0) {
         ASSERT(nextIndexBlocks != NULL);
-        for (int i = 0; i < levelSectors; i++) {
-            ASSERT(nextIndexBlocks[i] != NULL);
-            delete nextIndexBlocks[i];
+        for (int i = 0; i < NumSectorInt; i++) {
+            if (nextIndexBlocks[i] != NULL)
+                delete nextIndexBlocks[i];
         }
-        delete[] nextIndexBlocks;
+        childTablePool.Put(nextIndexBlocks);
     }
+
+    if (lruPrev != NULL)
+        lruPrev->lruNext = lruNext;
+    else
+        lruHead = lruNext;
+    if (lruNext != NULL)
+        lruNext->lruPrev = lruPrev;
+    else
+        lruTail = lruPrev;
+    numInCore--;
 }
-bool IndexBlock::Allocate(PersistentBitmap *freeMap, int remSize) {
-    // if (debug->IsEnabled('f'))
-    //     printf("IndexBlock::Allocate(%x, %d)\n", freeMap, remSize);
 
-    ASSERT(remSize > 0);
+//----------------------------------------------------------------------
+// IndexBlock::operator new
+// IndexBlock::operator delete
+// 	Get an index block from the pool of them, and put it back.
+//----------------------------------------------------------------------
+
+void *IndexBlock::operator new(size_t size) {
+    ASSERT(size == sizeof(IndexBlock));
+    return indexBlockPool.Get();
+}
+
+void IndexBlock::operator delete(void *object) {
+    indexBlockPool.Put(object);
+}
+
+//----------------------------------------------------------------------
+// IndexBlock::Grow
+// 	Make this block map "remSize" bytes instead of numBytes.  The new
+//	pointers are holes, so only the sizes change, here and in the last
+//	child if it is in memory (one on disk gets its size when it is
+//	read in).  A new block starts out mapping nothing, and is dirty
+//	since its sector has not been written yet.
+//
+//	"remSize" is the number of bytes of the file under this block
+//----------------------------------------------------------------------
+
+void IndexBlock::Grow(int remSize) {
+    IndexBlock *last = NULL;
+    int oldLevelSectors = levelSectors;
+
+    ASSERT(remSize >= numBytes);
+    if (numBytes < 0) {
+        MarkDirty();
+        oldLevelSectors = 0;
+    }
+    if (level != 0 && oldLevelSectors > 0)
+        last = nextIndexBlocks[oldLevelSectors - 1];
 
     numBytes = remSize;
     numSectors = divRoundUp(remSize, SectorSize);
     levelSectors = divRoundUp(remSize, sizePerPointer[level]);
+    if (last != NULL)
+        last->Grow(ChildBytes(oldLevelSectors - 1));
+}
 
-    // if (debug->IsEnabled('f')) {
-    //     printf("level: %d\n", level);
-    //     printf("sizePerPointer: %d\n", sizePerPointer[level]);
-    //     printf("levelSectors: %d\n", levelSectors);
-    // }
+//----------------------------------------------------------------------
+// IndexBlock::Fill
+// 	Allocate the holes under this block between bytes "from" and "to"
+//	(relative to the start of the block): data sectors at level 0,
+//	and otherwise index blocks, which are then filled in turn.
+//	The caller has made sure there are enough free sectors.
+//
+//	"source" supplies the sectors
+//----------------------------------------------------------------------
 
-    for (int i = 0; i < levelSectors; i++) {
-        nextSectors[i] = freeMap->FindAndSet();
-        ASSERT(freeMap->Test((int)nextSectors[i]));
+void IndexBlock::Fill(int from, int to, SectorSource *source) {
+    int size = sizePerPointer[level];
+
+    ASSERT(0 <= from && from < to && to <= numBytes);
+    for (int i = from / size; i * size < to; i++) {
+        if (nextSectors[i] == HoleSector) {
+            MarkDirty();
+            if (level == 0) {
+                nextSectors[i] = source->NextData();
+                continue;
+            }
+            nextSectors[i] = source->NextIndex();
+            nextIndexBlocks[i] = new IndexBlock(level - 1, this, &nextIndexBlocks[i]);
+            nextIndexBlocks[i]->Grow(ChildBytes(i));
+        }
+        if (level != 0)
+            Child(i)->Fill(max(from - i * size, 0), min(to - i * size, ChildBytes(i)), source);
     }
+}
 
-    if (level != 0) {
-        nextIndexBlocks = new IndexBlock *[NumSectorInt];
-        memset(nextIndexBlocks, 0, sizeof(IndexBlock *) * NumSectorInt);
-        for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i] = new IndexBlock(level - 1);
-            if (!nextIndexBlocks[i]->Allocate(freeMap, ((i == levelSectors - 1 && numBytes % sizePerPointer[level]) ? remSize % sizePerPointer[level] : sizePerPointer[level])))
-                return FALSE;
+//----------------------------------------------------------------------
+// IndexBlock::Adopt
+// 	Become the only child of a file header that is getting one more
+//	level: take over its "count" pointers, and the in-core blocks
+//	below them, which now map "remSize" bytes under us.
+//----------------------------------------------------------------------
+
+void IndexBlock::Adopt(int count, int *sectors, IndexBlock **children, int remSize) {
+    numBytes = remSize;
+    numSectors = divRoundUp(remSize, SectorSize);
+    levelSectors = count;
+    ASSERT(levelSectors == divRoundUp(remSize, sizePerPointer[level]));
+    for (int i = 0; i < count; i++) {
+        nextSectors[i] = sectors[i];
+        if (level != 0 && children[i] != NULL) {
+            nextIndexBlocks[i] = children[i];
+            children[i]->parent = this;
+            children[i]->slot = &nextIndexBlocks[i];
         }
     }
-    return TRUE;
+    MarkDirty();
 }
+
 void IndexBlock::Deallocate(PersistentBitmap *freeMap) {
     // if (debug->IsEnabled('f'))
     //     printf("IndexBlock::Deallocate(%x)\n", freeMap);
 
-    if (level != 0) {
-        for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i]->Deallocate(freeMap);
-        }
-    }
+    int length = (level == 0) ? sectorsPerBlock : 1;  // sectors per pointer
 
     for (int i = 0; i < levelSectors; i++) {
-        ASSERT(freeMap->Test((int)nextSectors[i]));
-        freeMap->Clear((int)nextSectors[i]);
+        if (nextSectors[i] == HoleSector)
+            continue;
+        if (level != 0)
+            Child(i)->Deallocate(freeMap);
+        for (int j = 0; j < length; j++) {
+            ASSERT(freeMap->Test((int)nextSectors[i] + j));
+            freeMap->Clear((int)nextSectors[i] + j);
+        }
     }
 }
 void IndexBlock::FetchFrom(int sector, int remSize) {
@@ -107,21 +296,17 @@ void IndexBlock::FetchFrom(int sector, int remSize) {
     numSectors = divRoundUp(remSize, SectorSize);
     levelSectors = divRoundUp(remSize, sizePerPointer[level]);
     kernel->synchDisk->ReadSector(sector, (char *)nextSectors);
-
-    if (level != 0) {
-        nextIndexBlocks = new IndexBlock *[NumSectorInt];
-        memset(nextIndexBlocks, 0, sizeof(IndexBlock *) * NumSectorInt);
-        for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i] = new IndexBlock(level - 1);
-            nextIndexBlocks[i]->FetchFrom(nextSectors[i], (i == levelSectors - 1 && numBytes % sizePerPointer[level] ? remSize % sizePerPointer[level] : sizePerPointer[level]));
-        }
-    }
+    dirty = FALSE;
+    // the blocks below this one are read in by Child, when needed
 }
 void IndexBlock::WriteBack(int sector) {
     // if (debug->IsEnabled('f'))
     //     printf("IndexBlock::WriteBack(%d), level:%d\n", sector, level);
 
+    if (!dirty)
+        return;  // neither we nor anything below us changed
     kernel->synchDisk->WriteSector(sector, (char *)nextSectors);
+    dirty = FALSE;
 
     if (level != 0) {
         for (int i = 0; i < levelSectors; i++) {
@@ -138,30 +323,87 @@ int IndexBlock::ByteToSector(int offset) {
     ASSERT(offset >= 0);
     ASSERT(offset < levelSectors * sizePerPointer[level]);
 
+    int levelSector = offset / sizePerPointer[level];
+    if (level == 0)
+        return BlockToSector(nextSectors, offset);
+    if (nextSectors[levelSector] == HoleSector)
+        return HoleSector;
+    return Child(levelSector)->ByteToSector(offset - levelSector * sizePerPointer[level]);
+}
+int IndexBlock::ByteToRun(int offset, int maxSectors, int *runLength) {
+    int levelSector = offset / sizePerPointer[level];
+
+    ASSERT(offset >= 0);
+    ASSERT(offset < levelSectors * sizePerPointer[level]);
+
+    if (level != 0) {
+        int inner = offset - levelSector * sizePerPointer[level];
+
+        if (nextSectors[levelSector] == HoleSector) {  // the rest of its span
+            *runLength = min(maxSectors, divRoundUp(ChildBytes(levelSector), SectorSize) -
+                                             inner / SectorSize);
+            return HoleSector;
+        }
+        return Child(levelSector)->ByteToRun(inner, maxSectors, runLength);
+    }
+
+    // the run stops at the end of this index block, even if the next
+    // one happens to continue it
+    return BlockRun(nextSectors, levelSectors, offset, maxSectors, runLength);
+}
+//----------------------------------------------------------------------
+// IndexBlock::LeafBlocks
+// 	Return the pointers of the block at level 0 under us that maps
+//	byte "offset" (relative to the start of this block), and set
+//	"*start" and "*end" to the bytes they map.  If "offset" is in a
+//	hole above level 0, return NULL, and set them to the bytes of
+//	the hole instead.
+//----------------------------------------------------------------------
+
+int *IndexBlock::LeafBlocks(int offset, int *start, int *end) {
+    int size = sizePerPointer[level];
+    int i = offset / size;
+    int *blocks;
+
+    ASSERT(offset >= 0 && offset < numBytes);
     if (level == 0) {
-        return nextSectors[offset / sizePerPointer[level]];
-    } else {
-        int levelSector = offset / sizePerPointer[level];
-        return nextIndexBlocks[levelSector]->ByteToSector(offset - levelSector * sizePerPointer[level]);
+        *start = 0;
+        *end = numBytes;
+        return nextSectors;
     }
+    if (nextSectors[i] == HoleSector) {
+        *start = i * size;
+        *end = i * size + ChildBytes(i);
+        return NULL;
+    }
+    blocks = Child(i)->LeafBlocks(offset - i * size, start, end);
+    *start += i * size;
+    *end += i * size;
+    return blocks;
 }
 void IndexBlock::PrintSectors() {
     for (int i = 0; i < levelSectors; i++)
-        printf("%d ", nextSectors[i]);
+        if (nextSectors[i] != HoleSector)
+            printf("%d ", nextSectors[i]);
 
     if (level != 0) {
         for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i]->PrintSectors();
+            if (nextSectors[i] != HoleSector)
+                Child(i)->PrintSectors();
         }
     }
 }
 void IndexBlock::PrintContents() {
     int i, k, j;
-    char *data = new char[SectorSize];
+    int length = (level == 0) ? sectorsPerBlock : 1;  // sectors per pointer
+    char *data = new char[length * SectorSize];
 
     for (i = k = 0; i < levelSectors; i++) {
-        kernel->synchDisk->ReadSector(nextSectors[i], data);
-        for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
+        if (nextSectors[i] == HoleSector)
+            memset(data, 0, length * SectorSize);  // a hole reads as zeros
+        else
+            kernel->synchDisk->ReadSectors(nextSectors[i], data, length);
+        for (j = 0; (j < length * SectorSize) && (k < numBytes); j++, k++) {
             if ('\040' <= data[j] && data[j] <= '\176')  // isprint(data[j])
                 printf("%c", data[j]);
             else
@@ -173,7 +415,8 @@ void IndexBlock::PrintContents() {
 
     if (level != 0) {
         for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i]->PrintContents();
+            if (nextSectors[i] != HoleSector)
+                Child(i)->PrintContents();
         }
     }
 }
@@ -181,12 +424,122 @@ int IndexBlock::GetIndexBlockSize() {
     int ret = SectorSize;
     if (level != 0) {
         for (int i = 0; i < levelSectors; i++) {
-            ret += nextIndexBlocks[i]->GetIndexBlockSize();
+            if (nextSectors[i] != HoleSector)
+                ret += Child(i)->GetIndexBlockSize();
         }
     }
     return ret;
 }
 
+//----------------------------------------------------------------------
+// IndexBlock::Load
+// 	Make room for an index block by dropping old blocks if we are
+//	over the limit, then read it in from disk and record it in "*slot".
+//
+//	"parent" is the block pointing to it (NULL for the file header)
+//	"sector" is where it is stored, "remSize" how much data it maps
+//----------------------------------------------------------------------
+
+IndexBlock *IndexBlock::Load(int level, IndexBlock *parent, IndexBlock **slot,
+                             int sector, int remSize) {
+    DEBUG(dbgFile, "Loading level " << level << " index block from sector " << sector);
+    Reclaim(parent);
+    *slot = new IndexBlock(level, parent, slot);
+    (*slot)->FetchFrom(sector, remSize);
+    return *slot;
+}
+
+//----------------------------------------------------------------------
+// IndexBlock::Reclaim
+// 	Delete least recently used index blocks until no more than
+//	MaxInCoreIndexBlocks are left.  Dirty blocks are skipped, since
+//	their changes would be lost.
+//
+//	Since a block is always ahead of its children on the list, a clean
+//	block reached from the tail has no children left in memory (they
+//	were either dropped already, or are dirty -- but then so is it).
+//	The blocks on the path of the current lookup are at the front of
+//	the list, and "keep" and its ancestors are skipped in case every
+//	other block is dirty.
+//----------------------------------------------------------------------
+
+void IndexBlock::Reclaim(IndexBlock *keep) {
+    IndexBlock *block = lruTail;
+
+    while (numInCore > MaxInCoreIndexBlocks && block != NULL) {
+        IndexBlock *prev = block->lruPrev;
+        IndexBlock *kept = keep;
+
+        while (kept != NULL && kept != block)
+            kept = kept->parent;
+        if (!block->dirty && kept == NULL) {
+            *block->slot = NULL;
+            delete block;
+        }
+        block = prev;
+    }
+}
+
+//----------------------------------------------------------------------
+// IndexBlock::Child
+// 	Return the index block below pointer "i", reading it in if it is
+//	not in memory.
+//----------------------------------------------------------------------
+
+IndexBlock *IndexBlock::Child(int i) {
+    ASSERT(level != 0 && i < levelSectors && nextSectors[i] != HoleSector);
+    if (nextIndexBlocks[i] == NULL)
+        return Load(level - 1, this, &nextIndexBlocks[i], nextSectors[i], ChildBytes(i));
+    nextIndexBlocks[i]->Touch();
+    return nextIndexBlocks[i];
+}
+
+//----------------------------------------------------------------------
+// IndexBlock::ChildBytes
+// 	Return the number of bytes of the file mapped by pointer "i";
+//	only the last pointer maps less than sizePerPointer.
+//----------------------------------------------------------------------
+
+int IndexBlock::ChildBytes(int i) {
+    if (i == levelSectors - 1 && numBytes % sizePerPointer[level])
+        return numBytes % sizePerPointer[level];
+    return sizePerPointer[level];
+}
+
+//----------------------------------------------------------------------
+// IndexBlock::MarkDirty
+// 	Note that this block has changed, and so has to be written back
+//	along with its ancestors (which WriteBack goes through to get to
+//	it).
+//----------------------------------------------------------------------
+
+void IndexBlock::MarkDirty() {
+    for (IndexBlock *block = this; block != NULL && !block->dirty; block = block->parent)
+        block->dirty = TRUE;
+}
+
+//----------------------------------------------------------------------
+// IndexBlock::Touch
+// 	Move this block, then each of its ancestors, to the front of the
+//	list of in-core blocks, keeping every block ahead of its children.
+//----------------------------------------------------------------------
+
+void IndexBlock::Touch() {
+    for (IndexBlock *block = this; block != NULL; block = block->parent) {
+        if (block == lruHead)
+            continue;
+        block->lruPrev->lruNext = block->lruNext;
+        if (block == lruTail)
+            lruTail = block->lruPrev;
+        else
+            block->lruNext->lruPrev = block->lruPrev;
+        block->lruPrev = NULL;
+        block->lruNext = lruHead;
+        lruHead->lruPrev = block;
+        lruHead = block;
+    }
+}
+
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::FileHeader
@@ -201,6 +554,13 @@ FileHeader::FileHeader() {
     numBytes = -1;
     numSectors = -1;
     memset(dataSectors, -1, sizeof(dataSectors));
+    hdrSector = -1;
+    mapVersion = 0;
+    inlined = FALSE;
+    memset(inlineData, 0, sizeof(inlineData));
+    extentBased = FALSE;
+    numExtents = 0;
+    memset(extents, 0, sizeof(extents));
     // MP4 start
     level = LDirect;
     levelSectors = -1;
@@ -223,23 +583,38 @@ FileHeader::~FileHeader() {
     if (level != LDirect) {
         ASSERT(nextIndexBlocks != NULL);
         for (int i = 0; i < levelSectors; i++) {
-            ASSERT(nextIndexBlocks[i] != NULL);
-            delete nextIndexBlocks[i];
+            if (nextIndexBlocks[i] != NULL)
+                delete nextIndexBlocks[i];
         }
-        delete[] nextIndexBlocks;
+        childTablePool.Put(nextIndexBlocks);
     }
     // MP4 end
 }
 
+//----------------------------------------------------------------------
+// FileHeader::operator new
+// FileHeader::operator delete
+// 	Get a file header from the pool of them, and put it back.
+//----------------------------------------------------------------------
+
+void *FileHeader::operator new(size_t size) {
+    ASSERT(size == sizeof(FileHeader));
+    return headerPool.Get();
+}
+
+void FileHeader::operator delete(void *object) {
+    headerPool.Put(object);
+}
+
 void FileHeader::InitLevel() {
     // MP4 start
-    if (numBytes <= MaxDirectBytes) {
+    if (numBytes <= NumPointers * sizePerPointer[LDirect]) {
         level = LDirect;
-    } else if (numBytes <= MaxSingleIndirectBytes) {
+    } else if (numBytes <= NumPointers * sizePerPointer[LSingle]) {
         level = LSingle;
-    } else if (numBytes <= MaxDoubleIndirectBytes) {
+    } else if (numBytes <= (long long)NumPointers * sizePerPointer[LDouble]) {
         level = LDouble;
-    } else if (numBytes <= MaxTripleIndirectBytes) {
+    } else if (numBytes <= maxFileSize) {
         level = LTriple;
     } else {
         ASSERT((FALSE));  // Not supported file size;
@@ -249,59 +624,500 @@ void FileHeader::InitLevel() {
 
 //----------------------------------------------------------------------
 // FileHeader::Allocate
-// 	Initialize a fresh file header for a newly created file.
-//	Allocate data blocks for the file out of the map of free disk blocks.
-//	Return FALSE if there are not enough free blocks to accomodate
-//	the new file.
+// 	Initialize a fresh file header for a newly created file of
+//	"fileSize" bytes.  No data blocks are allocated: a tiny file is
+//	kept in the header, and otherwise the whole file is a hole, which
+//	reads as zeros, and sectors are found for it by Fill as it gets
+//	written.  Return FALSE if the file would be bigger than
+//	MaxFileSize().
 //
 //	"freeMap" is the bit map of free disk sectors
-//	"fileSize" is the bit map of free disk sectors
+//	"fileSize" is the length of the new file, in bytes
+//	"sector" is where the header will be stored; data is put near it
 //----------------------------------------------------------------------
 
-bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize) {
+bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize, int sector) {
     // MP4 start
     // if (debug->IsEnabled('f'))
     //     printf("FileHeader::Allocate(%x, %d)\n", freeMap, fileSize);
 
+    if (fileSize > maxFileSize)
+        return FALSE;
+    mapVersion++;
+    hdrSector = sector;
     numBytes = fileSize;
-    numSectors = divRoundUp(fileSize, SectorSize);
-    if (freeMap->NumClear() < numSectors)
-        return FALSE;  // not enough space
+    numSectors = 0;  // none of it is mapped yet
+    inlined = (fileSize <= MaxInlineBytes);
+    memset(inlineData, 0, sizeof(inlineData));
+    extentBased = !inlined;
+    numExtents = 0;
+    memset(extents, 0, sizeof(extents));
+    levelSectors = 0;
+    // MP4 end
+    return TRUE;
+}
 
-    // for (int i = 0; i < numSectors; i++) {
-    //     dataSectors[i] = freeMap->FindAndSet();
-    //     // since we checked that there was enough free space,
-    //     // we expect this to succeed
-    //     ASSERT(dataSectors[i] >= 0);
-    // }
+//----------------------------------------------------------------------
+// FileHeader::Fill
+// 	Allocate disk sectors for the holes between bytes "from" and "to"
+//	of the file, making the file "to" bytes long if it is shorter.
+//	The caller is about to write the whole range, so the new sectors
+//	need not be cleared.  Return FALSE, leaving the header and the
+//	free map as they were, if there is not enough space.
+//
+//	The data blocks at either end of the range may take in sectors
+//	that the caller does not write.  If the block was a hole, those
+//	sectors are zeroed, so that they still read as zeros.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"from" and "to" are the byte range, "from" < "to"
+//----------------------------------------------------------------------
 
-    InitLevel();
+bool FileHeader::Fill(PersistentBitmap *freeMap, int from, int to) {
+    int first = from / SectorSize, last = (to - 1) / SectorSize;  // sectors written
+    int headFirst = first - first % sectorsPerBlock;
+    int tailLast = last - last % sectorsPerBlock + sectorsPerBlock - 1;
+    bool headHole = FALSE, tailHole = FALSE;
 
-    levelSectors = divRoundUp(fileSize, sizePerPointer[level]);
-    // if (debug->IsEnabled('f')) {
-    //     printf("level: %d\n", level);
-    //     printf("sizePerPointer: %d\n", sizePerPointer[level]);
-    //     printf("levelSectors: %d\n", levelSectors);
-    // }
+    ASSERT(0 <= from && from < to);
+    if (sectorsPerBlock > 1 && !inlined) {  // Uninline fills in two steps
+        headHole = (headFirst < first && IsHole(from));
+        tailHole = (tailLast > last && IsHole(to - 1));
+    }
+    if (!FillRange(freeMap, from, to))
+        return FALSE;
+    mapVersion++;
+    if (headHole)
+        ClearSectors(headFirst, first - 1);
+    if (tailHole)
+        ClearSectors(last + 1, tailLast);
+    return TRUE;
+}
 
-    for (int i = 0; i < levelSectors; i++) {
-        dataSectors[i] = freeMap->FindAndSet();
-        ASSERT(dataSectors[i] >= 0);
+//----------------------------------------------------------------------
+// FileHeader::FillRange
+// 	Allocate the holes between bytes "from" and "to", for Fill.
+//
+//	An inline file that would outgrow its header moves to a data
+//	sector first (see Uninline).
+//
+//	An extent-based header maps a prefix of its sectors; if the range
+//	starts inside it or right after it, the extents grow to cover the
+//	range, reserving more sectors as they go (see MapExtents).
+//	Otherwise, or when it runs out of extents, the header is converted
+//	to the indexed format, where holes are filled a pointer (and
+//	index block) at a time.
+//----------------------------------------------------------------------
+
+bool FileHeader::FillRange(PersistentBitmap *freeMap, int from, int to) {
+    SectorSource source(freeMap, NULL, 0, Goal(from));
+    int newLevel;
+
+    if (to > maxFileSize)
+        return FALSE;
+    if (inlined) {
+        if (to > MaxInlineBytes)
+            return Uninline(freeMap, from, to);
+        numBytes = max(numBytes, to);
+        return TRUE;
     }
+    if (extentBased) {
+        int oldSize = numBytes;
+        int last = divRoundUp(to, SectorSize);
 
-    if (level != LDirect) {
-        nextIndexBlocks = new IndexBlock *[NumPointers];
-        memset(nextIndexBlocks, 0, sizeof(IndexBlock *) * NumPointers);
-        for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i] = new IndexBlock(level - 1);
-            if (!nextIndexBlocks[i]->Allocate(freeMap, ((i == levelSectors - 1 && fileSize % sizePerPointer[level]) ? fileSize % sizePerPointer[level] : sizePerPointer[level])))
+        numBytes = max(numBytes, to);
+        if (last <= numSectors)
+            return TRUE;  // mapped already
+        if (from / SectorSize <= numSectors && MapExtents(freeMap, last))
+            return TRUE;
+        if (ConvertToIndexed(freeMap, from, to))
+            return TRUE;
+        numBytes = oldSize;
+        return FALSE;
+    }
+
+    // at most one index block per new level, and one block for every
+    // pointer in the range (an index block may use up a free block)
+    newLevel = LevelFor(max(numBytes, to));
+    if (freeMap->NumFreeBlocks() < (newLevel - level) + RangeBlocks(newLevel, from, to))
+        return FALSE;
+    if (to > numBytes)
+        ExtendIndexed(to, &source);
+    FillIndexed(from, to, &source);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Uninline
+// 	Turn an inline file into an extent-based one: copy its data out
+//	to a new data block, then allocate the range "from".."to" as
+//	Fill does.  Return FALSE, leaving the file inline and the free
+//	map as it was, if there is not enough space.
+//----------------------------------------------------------------------
+
+bool FileHeader::Uninline(PersistentBitmap *freeMap, int from, int to) {
+    int size = numBytes;
+
+    DEBUG(dbgFile, "Moving " << size << " bytes of inline data to a data sector");
+    inlined = FALSE;
+    extentBased = TRUE;
+    if (size == 0 || Fill(freeMap, 0, size)) {
+        if (Fill(freeMap, from, to)) {
+            if (size > 0) {  // else sector 0 may well be a hole
+                char *data = new char[SectorSize];
+
+                memset(data, 0, SectorSize);
+                memcpy(data, inlineData, size);
+                kernel->synchDisk->WriteSector(ByteToSector(0), data);
+                delete[] data;
+            }
+            memset(inlineData, 0, sizeof(inlineData));
+            return TRUE;
+        }
+        Deallocate(freeMap);
+    }
+    numBytes = size;
+    numSectors = numExtents = 0;
+    memset(extents, 0, sizeof(extents));
+    extentBased = FALSE;
+    inlined = TRUE;
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MapExtents
+// 	Map the first "sectors" sectors of an extent-based file, rounded
+//	up to whole blocks.  When it needs more than it has reserved, it
+//	reserves about as many again (up to MaxReserve), to keep the
+//	number of extents down.  Return FALSE, leaving the header and the
+//	free map as they were, if there is not enough space or the header
+//	runs out of extents.
+//----------------------------------------------------------------------
+
+bool FileHeader::MapExtents(PersistentBitmap *freeMap, int sectors) {
+    int needed = divRoundUp(sectors, sectorsPerBlock) * sectorsPerBlock;
+    int reserved = 0;
+    int oldNumExtents = numExtents;
+
+    for (int i = 0; i < numExtents; i++)
+        reserved += extents[i].length;
+
+    if (needed > reserved) {
+        int want = max(needed - reserved, min(reserved, MaxReserve));
+        Extent *last = (numExtents > 0) ? &extents[numExtents - 1] : NULL;
+        int oldLastLength = (last != NULL) ? last->length : 0;
+        int goal = hdrSector;
+
+        if (freeMap->NumClear() < needed - reserved)
+            return FALSE;
+        while (last != NULL && want > 0 &&
+               last->start + last->length + sectorsPerBlock <= NumSectors &&
+               RunFree(freeMap, last->start + last->length, sectorsPerBlock)) {
+            for (int j = 0; j < sectorsPerBlock; j++)
+                freeMap->Mark(last->start + last->length + j);
+            last->length += sectorsPerBlock;
+            reserved += sectorsPerBlock;
+            want -= sectorsPerBlock;
+        }
+        while (reserved < needed) {
+            Extent *e;
+            int start = -1, length = 0;
+
+            if (numExtents < MaxExtents) {
+                if (numExtents > 0) {  // as close after the last one as we can
+                    e = &extents[numExtents - 1];
+                    goal = (e->start + e->length) % NumSectors;
+                }
+                start = freeMap->FindRun(want, &length, goal);
+                length -= length % sectorsPerBlock;  // whole blocks only
+            }
+            if (length == 0) {
+                DEBUG(dbgFile, "Out of extents, cannot extend file in place");
+                for (; numExtents > oldNumExtents; numExtents--) {
+                    e = &extents[numExtents - 1];
+                    for (int j = 0; j < e->length; j++)
+                        freeMap->Clear(e->start + j);
+                    e->start = e->length = 0;
+                }
+                if (last != NULL) {
+                    for (int j = oldLastLength; j < last->length; j++)
+                        freeMap->Clear(last->start + j);
+                    last->length = oldLastLength;
+                }
                 return FALSE;
+            }
+            e = &extents[numExtents];
+            e->start = start;
+            e->length = length;
+            for (int i = 0; i < e->length; i++)
+                freeMap->Mark(e->start + i);
+            numExtents++;
+            reserved += e->length;
+            want = max(want - e->length, needed - reserved);
         }
     }
-    // MP4 end
+    numSectors = max(numSectors, needed);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Goal
+// 	Return where to start looking for a free sector to hold byte
+//	"offset" of the file: just past the sector holding the data
+//	before it, if there is one, and otherwise the header.
+//----------------------------------------------------------------------
+
+int FileHeader::Goal(int offset) {
+    int index = min(offset, numBytes) / SectorSize - 1;  // sector before
+    int sector = HoleSector;
+
+    if (!inlined && index >= 0)
+        sector = ByteToSector(index * SectorSize);
+    if (sector == HoleSector)
+        return hdrSector;
+    return (sector + 1) % NumSectors;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ConvertToIndexed
+// 	Turn an extent-based header into an indexed one that maps the same
+//	data sectors, and the range "from".."to" besides; the rest of the
+//	file stays a hole, and the sectors reserved past the mapped ones
+//	are freed.  Return FALSE, changing nothing, if there is not enough
+//	room for the index blocks and the range.
+//----------------------------------------------------------------------
+
+bool FileHeader::ConvertToIndexed(PersistentBitmap *freeMap, int from, int to) {
+    int mapped = min(numSectors * SectorSize, numBytes);
+    int newLevel = LevelFor(numBytes);
+    int *sectors = new int[numSectors];
+    int n = 0;
+
+    for (int i = 0; i < numExtents; i++) {
+        for (int j = 0; j < extents[i].length; j++) {
+            if (n < numSectors)
+                sectors[n++] = extents[i].start + j;
+            else
+                freeMap->Clear(extents[i].start + j);  // reserved, not used
+        }
+    }
+    if (freeMap->NumFreeBlocks() < RangeBlocks(newLevel, 0, mapped) - numSectors / sectorsPerBlock +
+                                       RangeBlocks(newLevel, from, to)) {
+        for (int i = 0, k = 0; i < numExtents; i++)
+            for (int j = 0; j < extents[i].length; j++, k++)
+                if (k >= numSectors)
+                    freeMap->Mark(extents[i].start + j);  // reserved again
+        delete[] sectors;
+        return FALSE;
+    }
+
+    DEBUG(dbgFile, "Converting a file of " << numExtents << " extents to index blocks");
+    extentBased = FALSE;
+    numExtents = 0;
+    memset(extents, 0, sizeof(extents));
+    memset(dataSectors, -1, sizeof(dataSectors));
+    numSectors = divRoundUp(numBytes, SectorSize);
+    InitLevel();
+    levelSectors = divRoundUp(numBytes, sizePerPointer[level]);
+    if (level != LDirect) {
+        nextIndexBlocks = (IndexBlock **)childTablePool.Get();
+        memset(nextIndexBlocks, 0, sizeof(IndexBlock *) * NumPointers);
+    }
+
+    SectorSource source(freeMap, sectors, n, hdrSector);
+    if (mapped > 0)
+        FillIndexed(0, mapped, &source);
+    FillIndexed(from, to, &source);
+    delete[] sectors;
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::ExtendIndexed
+// 	Make an indexed file "newSize" bytes long, the new part a hole.
+//	First, while the file needs more levels of index blocks than it
+//	has, the pointers in the header move down into a new index block
+//	(LevelUp).  Then the sizes of the header and of the last index
+//	block are brought up to date; the new pointers are holes already.
+//	The caller has made sure there are enough free sectors.
+//
+//	"source" supplies the new index blocks
+//----------------------------------------------------------------------
+
+void FileHeader::ExtendIndexed(int newSize, SectorSource *source) {
+    int newLevel = LevelFor(newSize);
+    int oldLevelSectors;
+    IndexBlock *last = NULL;
+
+    while (level < newLevel)
+        LevelUp(source);
+
+    oldLevelSectors = levelSectors;
+    if (level != LDirect && oldLevelSectors > 0)
+        last = nextIndexBlocks[oldLevelSectors - 1];  // NULL if not in memory
+    numBytes = newSize;
+    numSectors = divRoundUp(newSize, SectorSize);
+    levelSectors = divRoundUp(newSize, sizePerPointer[level]);
+    if (last != NULL)
+        last->Grow(ChildBytes(oldLevelSectors - 1));
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FillIndexed
+// 	Allocate the holes in an indexed file between bytes "from" and
+//	"to", like IndexBlock::Fill.  The caller has made sure there are
+//	enough free sectors.
+//
+//	"source" supplies the sectors
+//----------------------------------------------------------------------
+
+void FileHeader::FillIndexed(int from, int to, SectorSource *source) {
+    int size = sizePerPointer[level];
+
+    ASSERT(0 <= from && from < to && to <= numBytes);
+    for (int i = from / size; i * size < to; i++) {
+        if (dataSectors[i] == HoleSector) {
+            if (level == LDirect) {
+                dataSectors[i] = source->NextData();
+                continue;
+            }
+            dataSectors[i] = source->NextIndex();
+            nextIndexBlocks[i] = new IndexBlock(level - 1, NULL, &nextIndexBlocks[i]);
+            nextIndexBlocks[i]->Grow(ChildBytes(i));
+        }
+        if (level != LDirect)
+            Child(i)->Fill(max(from - i * size, 0), min(to - i * size, ChildBytes(i)), source);
+    }
+}
+
+//----------------------------------------------------------------------
+// FileHeader::LevelUp
+// 	Add a level of index blocks to the file: the pointers in the
+//	header, and the index blocks below them, go into a new index
+//	block, which becomes the header's only pointer.  If they are all
+//	holes, so is that pointer.
+//----------------------------------------------------------------------
+
+void FileHeader::LevelUp(SectorSource *source) {
+    IndexBlock **children = (IndexBlock **)childTablePool.Get();
+    bool empty = TRUE;
+
+    for (int i = 0; i < levelSectors; i++)
+        if (dataSectors[i] != HoleSector)
+            empty = FALSE;
+    memset(children, 0, sizeof(IndexBlock *) * NumPointers);
+    if (!empty) {
+        children[0] = new IndexBlock(level, NULL, &children[0]);
+        children[0]->Adopt(levelSectors, dataSectors, nextIndexBlocks, numBytes);
+        memset(dataSectors, -1, sizeof(dataSectors));
+        dataSectors[0] = source->NextIndex();
+    } else {
+        memset(dataSectors, -1, sizeof(dataSectors));
+    }
+    levelSectors = (numBytes > 0) ? 1 : 0;
+    childTablePool.Put(nextIndexBlocks);
+    nextIndexBlocks = children;
+    if (level == LDirect)
+        level = LSingle;
+    else if (level == LSingle)
+        level = LDouble;
+    else
+        level = LTriple;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ChildBytes
+// 	Return the number of bytes of the file mapped by header pointer
+//	"i"; only the last pointer maps less than sizePerPointer.
+//----------------------------------------------------------------------
+
+int FileHeader::ChildBytes(int i) {
+    if (i == levelSectors - 1 && numBytes % sizePerPointer[level])
+        return numBytes % sizePerPointer[level];
+    return sizePerPointer[level];
+}
+
+//----------------------------------------------------------------------
+// FileHeader::LevelFor
+// 	Return the level of index blocks a file of "fileSize" bytes
+//	needs, as InitLevel would set it.
+//----------------------------------------------------------------------
+
+int FileHeader::LevelFor(int fileSize) {
+    int level = LDirect;
+
+    while (fileSize > (long long)NumPointers * sizePerPointer[level]) {
+        level++;
+        ASSERT(level <= LTriple);  // not supported file size
+    }
+    return level;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::RangeBlocks
+// 	Return how many data blocks and index blocks it takes to map
+//	bytes "from".."to" of a file that has none yet, under pointers at
+//	"level" (so each pointer maps sizePerPointer[level] bytes).
+//----------------------------------------------------------------------
+
+int FileHeader::RangeBlocks(int level, int from, int to) {
+    int size = sizePerPointer[level];
+    int total = 0;
+
+    if (from >= to)
+        return 0;
+    if (level == LDirect)
+        return divRoundUp(to, size) - from / size;
+    for (int i = from / size; i * size < to; i++)
+        total += 1 + RangeBlocks(level - 1, max(from - i * size, 0), min(to - i * size, size));
+    return total;
+}
+
+//----------------------------------------------------------------------
+// SectorSource::SectorSource
+// 	Hand out the "count" sectors in "given" as data sectors, and then
+//	free sectors from "freeMap", the first one at or after "goal".
+//----------------------------------------------------------------------
+
+SectorSource::SectorSource(PersistentBitmap *freeMap, int *given, int count, int goal)
+    : freeMap(freeMap), given(given), count(count), goal(goal) {
+    ASSERT(goal >= 0 && goal < NumSectors);
+}
+
+//----------------------------------------------------------------------
+// SectorSource::NextData/NextIndex
+// 	Return the first sector of the next data block, or the sector for
+//	the next index block, taking it out of the free map if it came
+//	from there.  Sectors from the free map are handed out in disk
+//	order, from "goal" on, so that the file stays on as few tracks as
+//	it can.
+//----------------------------------------------------------------------
+
+int SectorSource::NextData() {
+    int sector;
+
+    if (count > 0) {
+        ASSERT(count >= sectorsPerBlock);
+        ASSERT(given[sectorsPerBlock - 1] == given[0] + sectorsPerBlock - 1);  // one block
+        sector = *given;
+        given += sectorsPerBlock;
+        count -= sectorsPerBlock;
+        return sector;
+    }
+    sector = freeMap->FindAndSetBlockNear(goal);
+    ASSERT(sector >= 0);  // the caller checked there was enough space
+    goal = (sector + sectorsPerBlock) % NumSectors;
+    return sector;
+}
+
+int SectorSource::NextIndex() {
+    int sector = freeMap->FindAndSetNear(goal);
+
+    ASSERT(sector >= 0);  // the caller checked there was enough space
+    goal = (sector + 1) % NumSectors;
+    return sector;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Deallocate
 // 	De-allocate all the space allocated for data blocks for this file.
@@ -319,14 +1135,29 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap) {
     //     freeMap->Clear((int)dataSectors[i]);
     // }
 
-    if (level != LDirect) {
-        for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i]->Deallocate(freeMap);
+    mapVersion++;
+    if (inlined)
+        return;  // no data blocks
+    if (extentBased) {
+        for (int i = 0; i < numExtents; i++) {
+            for (int j = 0; j < extents[i].length; j++) {
+                ASSERT(freeMap->Test(extents[i].start + j));  // ought to be marked!
+                freeMap->Clear(extents[i].start + j);
+            }
         }
+        return;
     }
+    int length = (level == LDirect) ? sectorsPerBlock : 1;  // sectors per pointer
+
     for (int i = 0; i < levelSectors; i++) {
-        ASSERT(freeMap->Test((int)dataSectors[i]));  // ought to be marked!
-        freeMap->Clear((int)dataSectors[i]);
+        if (dataSectors[i] == HoleSector)
+            continue;
+        if (level != LDirect)
+            Child(i)->Deallocate(freeMap);
+        for (int j = 0; j < length; j++) {
+            ASSERT(freeMap->Test((int)dataSectors[i] + j));  // ought to be marked!
+            freeMap->Clear((int)dataSectors[i] + j);
+        }
     }
     // MP4 end
 }
@@ -350,12 +1181,31 @@ void FileHeader::FetchFrom(int sector) {
             After you add some in-core informations, you will need to rebuild the header's structure
     */
     char buf[FileHeaderDiskSize];
+    hdrSector = sector;
+    mapVersion++;
     kernel->synchDisk->ReadSector(sector, buf);
     int offset = 0;
     memcpy(&numBytes, buf + offset, sizeof(numBytes));
     offset += sizeof(numBytes);
     memcpy(&numSectors, buf + offset, sizeof(numSectors));
     offset += sizeof(numSectors);
+    if (numSectors & InlineFlag) {
+        inlined = TRUE;
+        numSectors = 0;
+        memcpy(inlineData, buf + offset, sizeof(inlineData));
+        levelSectors = 0;
+        return;
+    }
+    if (numSectors & ExtentFlag) {
+        extentBased = TRUE;
+        numSectors &= ~ExtentFlag;
+        memcpy(&extents, buf + offset, sizeof(extents));
+        levelSectors = 0;
+        for (numExtents = 0; numExtents < MaxExtents && extents[numExtents].length > 0;
+             numExtents++)
+            ;  // may cover more than numSectors; see MapExtents
+        return;
+    }
     memcpy(&dataSectors, buf + offset, sizeof(dataSectors));
     offset += sizeof(dataSectors);
 
@@ -363,12 +1213,9 @@ void FileHeader::FetchFrom(int sector) {
 
     levelSectors = divRoundUp(numBytes, sizePerPointer[level]);
     if (level != LDirect) {
-        nextIndexBlocks = new IndexBlock *[NumPointers];
+        nextIndexBlocks = (IndexBlock **)childTablePool.Get();
         memset(nextIndexBlocks, 0, sizeof(IndexBlock *) * NumPointers);
-        for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i] = new IndexBlock(level - 1);
-            nextIndexBlocks[i]->FetchFrom(dataSectors[i], (i == levelSectors - 1 && numBytes % sizePerPointer[level] ? numBytes % sizePerPointer[level] : sizePerPointer[level]));
-        }
+        // the index blocks themselves are read in by Child, when needed
     }
     // MP4 end
 }
@@ -399,6 +1246,23 @@ void FileHeader::WriteBack(int sector) {
     int offset = 0;
     memcpy(buf + offset, &numBytes, sizeof(numBytes));
     offset += sizeof(numBytes);
+    if (inlined) {
+        int flagged = InlineFlag;
+        memcpy(buf + offset, &flagged, sizeof(flagged));
+        offset += sizeof(flagged);
+        memcpy(buf + offset, inlineData, sizeof(inlineData));
+        kernel->synchDisk->WriteSector(sector, buf);
+        return;
+    }
+    if (extentBased) {
+        int flagged = numSectors | ExtentFlag;
+        memcpy(buf + offset, &flagged, sizeof(flagged));
+        offset += sizeof(flagged);
+        memset(buf + offset, 0, sizeof(dataSectors));
+        memcpy(buf + offset, &extents, sizeof(extents));
+        kernel->synchDisk->WriteSector(sector, buf);
+        return;
+    }
     memcpy(buf + offset, &numSectors, sizeof(numSectors));
     offset += sizeof(numSectors);
     memcpy(buf + offset, &dataSectors, sizeof(dataSectors));
@@ -411,6 +1275,7 @@ void FileHeader::WriteBack(int sector) {
                 nextIndexBlocks[i]->WriteBack(dataSectors[i]);
             }
         }
+        IndexBlock::Reclaim(NULL);  // a new file's blocks are clean now
     }
     // MP4 end
 }
@@ -432,17 +1297,108 @@ int FileHeader::ByteToSector(int offset) {
 
     // return (dataSectors[offset / SectorSize]);
 
-    int sec = -1;
-    if (level == LDirect) {
-        sec = dataSectors[offset / sizePerPointer[level]];
-    } else {
-        int levelSector = offset / sizePerPointer[level];
-        sec = nextIndexBlocks[levelSector]->ByteToSector(offset - levelSector * sizePerPointer[level]);
+    ASSERT(!inlined);  // no sectors to find
+    if (extentBased) {
+        int index = offset / SectorSize;
+        if (index >= numSectors)
+            return HoleSector;  // past the mapped part
+        for (int i = 0; i < numExtents; i++) {
+            if (index < extents[i].length)
+                return extents[i].start + index;
+            index -= extents[i].length;
+        }
+        ASSERTNOTREACHED();  // offset past the end of the file
     }
-    return sec;
+
+    int levelSector = offset / sizePerPointer[level];
+    if (level == LDirect)
+        return BlockToSector(dataSectors, offset);
+    if (dataSectors[levelSector] == HoleSector)
+        return HoleSector;
+    return Child(levelSector)->ByteToSector(offset - levelSector * sizePerPointer[level]);
     // MP4 end
 }
 
+//----------------------------------------------------------------------
+// FileHeader::ByteToRun
+// 	Like ByteToSector, but also find how many sectors of the file,
+//	starting with the one holding "offset", lie next to each other on
+//	disk, so that they can be transferred with one request.  The run
+//	may be cut short where the file's map changes blocks; the caller
+//	just asks again for the rest.
+//
+//	"offset" is the location within the file of the first byte
+//	"maxSectors" is the most sectors the caller wants
+//	"runLength" is set to the number of sectors in the run
+//----------------------------------------------------------------------
+
+int FileHeader::ByteToRun(int offset, int maxSectors, int *runLength) {
+    int index = offset / SectorSize;
+
+    ASSERT(maxSectors >= 1 && !inlined);
+    if (extentBased) {
+        int left = numSectors - index;  // mapped sectors from here on
+
+        if (left <= 0) {  // the rest of the file is a hole
+            *runLength = min(maxSectors, divRoundUp(numBytes, SectorSize) - index);
+            return HoleSector;
+        }
+        for (int i = 0; i < numExtents; i++) {
+            if (index < extents[i].length) {
+                *runLength = min(min(maxSectors, left), extents[i].length - index);
+                return extents[i].start + index;
+            }
+            index -= extents[i].length;
+        }
+        ASSERTNOTREACHED();  // offset past the end of the file
+    }
+    if (level != LDirect) {
+        int levelSector = offset / sizePerPointer[level];
+        int inner = offset - levelSector * sizePerPointer[level];
+
+        if (dataSectors[levelSector] == HoleSector) {  // the rest of its span
+            *runLength = min(maxSectors, divRoundUp(ChildBytes(levelSector), SectorSize) -
+                                             inner / SectorSize);
+            return HoleSector;
+        }
+        return Child(levelSector)->ByteToRun(inner, maxSectors, runLength);
+    }
+    return BlockRun(dataSectors, levelSectors, offset, maxSectors, runLength);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::LeafBlocks
+// 	Return the pointers to the data blocks of an indexed file around
+//	byte "offset": the header's own, if it has no index blocks, and
+//	otherwise those of the index block at level 0 that maps it (see
+//	IndexBlock::LeafBlocks).  "*start" and "*end" are set to the bytes
+//	of the file they map, or, if NULL is returned, to the bytes of the
+//	hole "offset" is in.  The pointers are only good until the next
+//	index block is read in.
+//----------------------------------------------------------------------
+
+int *FileHeader::LeafBlocks(int offset, int *start, int *end) {
+    int size = sizePerPointer[level];
+    int i = offset / size;
+    int *blocks;
+
+    ASSERT(IsIndexed() && offset >= 0 && offset < numBytes);
+    if (level == LDirect) {
+        *start = 0;
+        *end = numBytes;
+        return dataSectors;
+    }
+    if (dataSectors[i] == HoleSector) {
+        *start = i * size;
+        *end = i * size + ChildBytes(i);
+        return NULL;
+    }
+    blocks = Child(i)->LeafBlocks(offset - i * size, start, end);
+    *start += i * size;
+    *end += i * size;
+    return blocks;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::FileLength
 // 	Return the number of bytes in the file.
@@ -452,6 +1408,42 @@ int FileHeader::FileLength() {
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::IsInline
+// 	Return TRUE if the file's data is kept in the header sector, so
+//	that it must be read and written with ReadInline and WriteInline
+//	instead of through the disk.
+//----------------------------------------------------------------------
+
+bool FileHeader::IsInline() {
+    return inlined;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReadInline
+// 	Copy "numBytes" bytes of an inline file, starting at "position",
+//	into "into".  The caller has checked they are in the file.
+//----------------------------------------------------------------------
+
+void FileHeader::ReadInline(char *into, int numBytes, int position) {
+    ASSERT(inlined && position >= 0 && position + numBytes <= this->numBytes);
+    memcpy(into, inlineData + position, numBytes);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::WriteInline
+// 	Copy "numBytes" bytes from "from" into an inline file, starting
+//	at "position", making the file longer if they go past its end.
+//	Any gap before "position" is already zeros.  The caller writes
+//	the header back to disk.
+//----------------------------------------------------------------------
+
+void FileHeader::WriteInline(char *from, int numBytes, int position) {
+    ASSERT(inlined && position >= 0 && position + numBytes <= MaxInlineBytes);
+    memcpy(inlineData + position, from, numBytes);
+    this->numBytes = max(this->numBytes, position + numBytes);
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Print
 // 	Print the contents of the file header, and the contents of all
@@ -464,20 +1456,58 @@ void FileHeader::Print() {
     //     printf("FileHeader::Print()\n");
 
     int i, j, k;
-    char *data = new char[SectorSize];
+    int length = (level == LDirect) ? sectorsPerBlock : 1;  // sectors per pointer
+    char *data = new char[sizePerPointer[LDirect]];
 
     printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
+    if (inlined) {
+        printf("(inline)\nFile contents:\n");
+        for (k = 0; k < numBytes; k++) {
+            if ('\040' <= inlineData[k] && inlineData[k] <= '\176')  // isprint
+                printf("%c", inlineData[k]);
+            else
+                printf("\\%x", (unsigned char)inlineData[k]);
+        }
+        printf("\n");
+        delete[] data;
+        return;
+    }
+    if (extentBased) {
+        for (i = 0; i < numExtents; i++)
+            printf("%d-%d ", extents[i].start, extents[i].start + extents[i].length - 1);
+        printf("\nFile contents:\n");
+        for (i = k = 0; k < numBytes; i++) {
+            if (i >= numSectors)
+                memset(data, 0, SectorSize);  // a hole reads as zeros
+            else
+                kernel->synchDisk->ReadSector(ByteToSector(i * SectorSize), data);
+            for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
+                if ('\040' <= data[j] && data[j] <= '\176')  // isprint(data[j])
+                    printf("%c", data[j]);
+                else
+                    printf("\\%x", (unsigned char)data[j]);
+            }
+            printf("\n");
+        }
+        delete[] data;
+        return;
+    }
     for (i = 0; i < levelSectors; i++)
-        printf("%d ", dataSectors[i]);
+        if (dataSectors[i] != HoleSector)
+            printf("%d ", dataSectors[i]);
     if (level != LDirect) {
         for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i]->PrintSectors();
+            if (dataSectors[i] != HoleSector)
+                Child(i)->PrintSectors();
         }
     }
     printf("\nFile contents:\n");
     for (i = k = 0; i < levelSectors; i++) {
-        kernel->synchDisk->ReadSector(dataSectors[i], data);
-        for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
+        if (dataSectors[i] == HoleSector)
+            memset(data, 0, length * SectorSize);  // a hole reads as zeros
+        else
+            kernel->synchDisk->ReadSectors(dataSectors[i], data, length);
+        for (j = 0; (j < length * SectorSize) && (k < numBytes); j++, k++) {
             if ('\040' <= data[j] && data[j] <= '\176')  // isprint(data[j])
                 printf("%c", data[j]);
             else
@@ -488,18 +1518,260 @@ void FileHeader::Print() {
     delete[] data;
     if (level != LDirect) {
         for (int i = 0; i < levelSectors; i++) {
-            nextIndexBlocks[i]->PrintContents();
+            if (dataSectors[i] != HoleSector)
+                Child(i)->PrintContents();
         }
     }
     // MP4 end
 }
 
+//----------------------------------------------------------------------
+// FileHeader::PrintSpread
+// 	Print how the file is spread over the disk: the track of the
+//	header, how many data sectors there are and on how many different
+//	tracks, the lowest and highest track used, and how many tracks
+//	the disk head crosses reading the file front to back, starting
+//	from the header.  Index blocks are not counted.
+//----------------------------------------------------------------------
+
+void FileHeader::PrintSpread() {
+    bool *used = new bool[NumTracks];
+    int fileSectors = divRoundUp(numBytes, SectorSize);
+    int track = hdrSector / SectorsPerTrack;
+    int lowest = track, highest = track;
+    int numData = 0, numTracks = 0, crossed = 0;
+    int sector, run;
+
+    memset(used, 0, NumTracks * sizeof(bool));
+    for (int i = 0; !inlined && i < fileSectors; i += run) {
+        sector = ByteToRun(i * SectorSize, fileSectors - i, &run);
+        if (sector == HoleSector)
+            continue;
+        numData += run;
+        for (int j = sector; j < sector + run; j++) {
+            int t = j / SectorsPerTrack;
+
+            if (!used[t]) {
+                used[t] = TRUE;
+                numTracks++;
+            }
+            crossed += (t > track) ? t - track : track - t;
+            track = t;
+            lowest = min(lowest, t);
+            highest = max(highest, t);
+        }
+    }
+    printf("header on track %d, %d data sectors on %d tracks (%d-%d), %d tracks crossed\n",
+           hdrSector / SectorsPerTrack, numData, numTracks, lowest, highest, crossed);
+    delete[] used;
+}
+
 int FileHeader::GetHeaderSize() {
     int ret = SectorSize;
     if (level != LDirect) {
         for (int i = 0; i < levelSectors; i++) {
-            ret += nextIndexBlocks[i]->GetIndexBlockSize();
+            if (dataSectors[i] != HoleSector)
+                ret += Child(i)->GetIndexBlockSize();
         }
     }
     return ret;
-}
\ No newline at end of file
+}
+
+//----------------------------------------------------------------------
+// FileHeader::SetBlockSize
+// 	Allocate file data "sectors" sectors at a time from now on, as the
+//	superblock of the disk being mounted says; every file on a disk
+//	has the same block size.  "sectors" is a power of two, at most
+//	MaxSectorsPerBlock.
+//----------------------------------------------------------------------
+
+void FileHeader::SetBlockSize(int sectors) {
+    long long size = sectors * SectorSize;
+
+    ASSERT(sectors > 0 && sectors <= MaxSectorsPerBlock && (sectors & (sectors - 1)) == 0);
+    sectorsPerBlock = sectors;
+    for (int level = LDirect; level <= LTriple; level++) {
+        sizePerPointer[level] = (int)size;
+        size *= NumSectorInt;
+    }
+    size = (long long)NumPointers * sizePerPointer[LTriple];
+    maxFileSize = (int)min(size, (long long)NumSectors * SectorSize);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MaxFileSize
+// 	Return the most bytes a file can hold, with the block size of the
+//	disk mounted.
+//----------------------------------------------------------------------
+
+int FileHeader::MaxFileSize() {
+    return maxFileSize;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::IsHole
+// 	Return TRUE if byte "offset" of the file has no sector on disk.
+//	Past the block holding the last byte of the file, everything is
+//	a hole; the index blocks only map up to there.
+//----------------------------------------------------------------------
+
+bool FileHeader::IsHole(int offset) {
+    if (offset >= divRoundUp(numBytes, sizePerPointer[LDirect]) * sizePerPointer[LDirect])
+        return TRUE;
+    return ByteToSector(offset) == HoleSector;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ClearSectors
+// 	Write zeros to sectors "first" through "last" of the file, which
+//	have just been allocated, but will not be written by the caller.
+//----------------------------------------------------------------------
+
+void FileHeader::ClearSectors(int first, int last) {
+    char *zeros = new char[sizePerPointer[LDirect]];
+    int sector, run;
+
+    memset(zeros, 0, sizePerPointer[LDirect]);
+    for (int i = first; i <= last; i += run) {
+        sector = ByteToRun(i * SectorSize, last - i + 1, &run);
+        ASSERT(sector != HoleSector && run <= sectorsPerBlock);
+        kernel->synchDisk->WriteSectors(sector, zeros, run);
+    }
+    delete[] zeros;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Child
+// 	Return the index block below pointer "i", reading it in if it is
+//	not in memory.
+//----------------------------------------------------------------------
+
+IndexBlock *FileHeader::Child(int i) {
+    ASSERT(level != LDirect && i < levelSectors && dataSectors[i] != HoleSector);
+    if (nextIndexBlocks[i] == NULL) {
+        int remSize = sizePerPointer[level];
+        if (i == levelSectors - 1 && numBytes % sizePerPointer[level])
+            remSize = numBytes % sizePerPointer[level];
+        return IndexBlock::Load(level - 1, NULL, &nextIndexBlocks[i], dataSectors[i], remSize);
+    }
+    nextIndexBlocks[i]->Touch();
+    return nextIndexBlocks[i];
+}
+
+//----------------------------------------------------------------------
+// MapCursor::MapCursor
+// 	Start out with nothing copied.
+//
+//	"hdr" -- the header of the open file
+//	"flatMax" -- the largest file, in sectors, whose whole map is
+//		copied (0 for none)
+//----------------------------------------------------------------------
+
+MapCursor::MapCursor(FileHeader *hdr, int flatMax) : hdr(hdr), flatMax(flatMax) {
+    version = -1;
+    start = end = 0;
+    blocks = NULL;
+    flat = NULL;
+}
+
+//----------------------------------------------------------------------
+// MapCursor::~MapCursor
+// 	De-allocate the copy of the map.
+//----------------------------------------------------------------------
+
+MapCursor::~MapCursor() {
+    delete[] flat;
+}
+
+//----------------------------------------------------------------------
+// MapCursor::operator new
+// MapCursor::operator delete
+// 	Get a map cursor from the pool of them, and put it back.
+//----------------------------------------------------------------------
+
+void *MapCursor::operator new(size_t size) {
+    ASSERT(size == sizeof(MapCursor));
+    return cursorPool.Get();
+}
+
+void MapCursor::operator delete(void *object) {
+    cursorPool.Put(object);
+}
+
+//----------------------------------------------------------------------
+// MapCursor::ByteToRun
+// 	Like FileHeader::ByteToRun, but from the copy of the map, if it
+//	is still good and covers "offset"; otherwise copy the part of the
+//	map around "offset" first.
+//
+//	"offset" is the location within the file of the first byte
+//	"maxSectors" is the most sectors the caller wants
+//	"runLength" is set to the number of sectors in the run
+//----------------------------------------------------------------------
+
+int MapCursor::ByteToRun(int offset, int maxSectors, int *runLength) {
+    ASSERT(maxSectors >= 1);
+    if (!hdr->IsIndexed())
+        return hdr->ByteToRun(offset, maxSectors, runLength);
+    if (version != hdr->MapVersion() || offset < start || offset >= end)
+        Refill(offset);
+    if (blocks == NULL) {  // the rest of the hole
+        *runLength = min(maxSectors, divRoundUp(end - offset, SectorSize));
+        return HoleSector;
+    }
+    return BlockRun(blocks, divRoundUp(end - start, sizePerPointer[0]), offset - start, maxSectors,
+                    runLength);
+}
+
+//----------------------------------------------------------------------
+// MapCursor::Refill
+// 	Copy the part of the map around "offset".  If the file is small
+//	enough, copy the whole map instead -- again each time the map has
+//	changed, so that a file built by writing to it gets one too.
+//----------------------------------------------------------------------
+
+void MapCursor::Refill(int offset) {
+    int *from;
+
+    delete[] flat;  // out of date, if we get here with it
+    flat = NULL;
+    version = hdr->MapVersion();
+    if (offset < hdr->FileLength() && divRoundUp(hdr->FileLength(), SectorSize) <= flatMax) {
+        CopyAll();
+        return;
+    }
+    from = hdr->LeafBlocks(offset, &start, &end);
+    blocks = NULL;
+    if (from != NULL) {
+        blocks = leaf;
+        memcpy(leaf, from, divRoundUp(end - start, sizePerPointer[0]) * sizeof(int));
+    }
+}
+
+//----------------------------------------------------------------------
+// MapCursor::CopyAll
+// 	Copy the whole map into "flat", a part at a time; a hole above
+//	level 0 is copied as hole pointers.
+//----------------------------------------------------------------------
+
+void MapCursor::CopyAll() {
+    int size = sizePerPointer[0];
+    int length = hdr->FileLength();
+    int from, to;
+
+    flat = new int[divRoundUp(length, size)];
+    for (int offset = 0; offset < length; offset = to) {
+        int *part = hdr->LeafBlocks(offset, &from, &to);
+
+        ASSERT(from == offset);
+        if (part == NULL) {
+            for (int i = from / size; i < divRoundUp(to, size); i++)
+                flat[i] = HoleSector;
+        } else {
+            memcpy(&flat[from / size], part, divRoundUp(to - from, size) * sizeof(int));
+        }
+    }
+    start = 0;
+    end = length;
+    blocks = flat;
+}
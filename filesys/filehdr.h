@@ -20,36 +20,147 @@
 // MP4 start
 const int NumSectorInt = (SectorSize / sizeof(int));
 const int NumPointers = ((SectorSize - 2 * sizeof(int)) / sizeof(int));
-const int MaxDirectBytes = (NumPointers * SectorSize);
-const int MaxSingleIndirectBytes = (NumPointers * NumSectorInt * SectorSize);
-const int MaxDoubleIndirectBytes = (NumPointers * NumSectorInt * NumSectorInt * SectorSize);
-const int MaxTripleIndirectBytes = (NumPointers * NumSectorInt * NumSectorInt * NumSectorInt * SectorSize);
-const int MaxFileSize = (MaxTripleIndirectBytes);
 const int FileHeaderDiskSize = (sizeof(int) + sizeof(int) + NumPointers * SectorSize);
-const int sizePerPointer[4] = {SectorSize, NumSectorInt *SectorSize, NumSectorInt *NumSectorInt *SectorSize, NumSectorInt *NumSectorInt *NumSectorInt *SectorSize};
 // Mp4 end
 
+// File data is allocated in blocks of one or more sectors, next to
+// each other on disk, as the superblock says (see SetBlockSize); a
+// pointer in the header or in an index block at the lowest level maps
+// a whole block, so a file of a given size needs fewer of them, and
+// fewer index blocks.  Index blocks and file headers still take one
+// sector each.  The most a file can hold follows from the block size,
+// up to the size of the disk.
+const int MaxSectorsPerBlock = 64;
+
+// An extent-based header keeps (start, length) runs of sectors in the
+// space the indexed header uses for its pointers.  On disk, such a
+// header has ExtentFlag set in its sector count; an indexed header
+// never does, since no disk has that many sectors.
+const int MaxExtents = (NumPointers / 2);
+const int ExtentFlag = (1 << 30);
+
+// A tiny file keeps its data in the header sector itself, where the
+// pointers would go, so that reading or writing it costs no I/O
+// beyond the header.  Such a header has InlineFlag set in its sector
+// count, and becomes extent-based when the file outgrows
+// MaxInlineBytes.
+const int InlineFlag = (1 << 29);
+const int MaxInlineBytes = (NumPointers * sizeof(int));
+
+// A pointer to a part of a file that has not been written yet is a
+// hole: it has no sector on disk, and reads as zeros.  At any level,
+// a hole maps everything under it; unused pointers are holes too.  An
+// extent-based header maps only its first numSectors sectors, and the
+// rest of the file is a hole.
+const int HoleSector = -1;
+
+// When an extent-based file grows past its last sector, it reserves
+// about as many sectors again as it already has (but no more than
+// MaxReserve), so that repeated small extensions use few extents.
+// The reserved sectors belong to the file until it is deleted, or
+// until it runs out of extents and is converted to the indexed format.
+const int MaxReserve = 1024;
+
+class Extent {
+   public:
+    int start;   // First sector of the run
+    int length;  // Number of sectors in the run
+};
+
+// The disk is divided into allocation groups of TracksPerGroup
+// tracks.  A file's header goes in the group of its directory, and
+// its data and index blocks as close after the header (or after the
+// data before them) as there is room, so that reading the file seeks
+// over few tracks.  A new directory starts in the emptiest group.
+const int TracksPerGroup = 32;
+const int SectorsPerGroup = (TracksPerGroup * SectorsPerTrack);
+const int NumGroups = (NumTracks / TracksPerGroup);
+
+// The following class hands out the sectors for holes being filled:
+// first "count" sectors that already hold the file's data (in file
+// order, a block's worth at a time), then free blocks, from "goal"
+// on.  Index blocks always come from the free map.
+
+class SectorSource {
+   public:
+    SectorSource(PersistentBitmap *freeMap, int *given, int count, int goal);
+
+    int NextData();   // First sector for the next data block
+    int NextIndex();  // Sector for a new index block
+
+   private:
+    PersistentBitmap *freeMap;
+    int *given;  // Sectors still to be handed out
+    int count;   // How many of them
+    int goal;    // Where to look for the next free sector
+};
+
 // MP4 Start
+// Index blocks are read from disk only when a lookup first needs them,
+// and at most MaxInCoreIndexBlocks of them (across all open files) are
+// kept in memory; beyond that, the least recently used clean ones are
+// dropped and re-read if they are needed again.
+const int MaxInCoreIndexBlocks = 128;
+
 class IndexBlock {
    public:
-    IndexBlock(int level);
+    IndexBlock(int level, IndexBlock *parent, IndexBlock **slot);
     ~IndexBlock();
-    bool Allocate(PersistentBitmap *freeMap, int remSize);
+
+    static void *operator new(size_t size);  // From a pool of them
+    static void operator delete(void *object);
+
+    void Grow(int remSize);  // Map "remSize" bytes now, the new part
+                             // a hole
+    void Fill(int from, int to, SectorSource *source);
+    // Allocate the holes in a byte range
+    void Adopt(int count, int *sectors, IndexBlock **children, int remSize);
+    // Take over a file header's pointers
     void Deallocate(PersistentBitmap *freeMap);
     void FetchFrom(int sector, int remSize);
     void WriteBack(int sector);
     int ByteToSector(int offset);
+    int ByteToRun(int offset, int maxSectors, int *runLength);
+    int *LeafBlocks(int offset, int *start, int *end);
+    // Pointers of the level 0 block
+    // that maps "offset"
     void PrintSectors();
     void PrintContents();
     int GetIndexBlockSize();
 
+    static IndexBlock *Load(int level, IndexBlock *parent, IndexBlock **slot,
+                            int sector, int remSize);
+    // Read in an index block, and hang it on
+    // "slot" in its parent
+    static void Reclaim(IndexBlock *keep);
+    // Drop clean blocks until at most
+    // MaxInCoreIndexBlocks are in memory,
+    // but not "keep" or its ancestors
+    void Touch();           // Move us and our ancestors to the front
+
    private:
     int level;
     int numBytes;
     int numSectors;
     int levelSectors;
     int nextSectors[NumSectorInt];
-    IndexBlock **nextIndexBlocks;
+    IndexBlock **nextIndexBlocks;  // in-core children, NULL if not loaded
+
+    bool dirty;            // Changed since it was read or written?
+                           // If so, so is its parent
+    IndexBlock *parent;    // Block pointing to this one, NULL if the
+                           // file header does
+    IndexBlock **slot;     // Where our parent keeps a pointer to us
+    IndexBlock *lruPrev;   // Neighbours on the list of in-core blocks;
+    IndexBlock *lruNext;   //   a block is always in front of its children
+
+    IndexBlock *Child(int i);  // Child "i", loading it if need be
+    int ChildBytes(int i);     // Bytes of the file under child "i"
+    void MarkDirty();          // Mark us, and so our ancestors, dirty
+
+    static IndexBlock *lruHead;  // Most recently used in-core block
+    static IndexBlock *lruTail;  // Least recently used in-core block
+    static int numInCore;        // Number of blocks in memory
 };
 // MP4 end
 
@@ -64,6 +175,15 @@ class IndexBlock {
 // as one disk sector.  Without indirect addressing, this
 // limits the maximum file length to just under 4K bytes.
 //
+// When the free map has room, a file is instead described by up to
+// MaxExtents runs of contiguous sectors, all held in the header
+// sector; the indexed format is only used if the data cannot be
+// found in that few pieces.  An indexed file grows by adding holes at
+// its end, and a level of index blocks above the header's pointers
+// when it outgrows them; data sectors and index blocks are only
+// allocated for the parts that get written.  A tiny file has no data
+// sectors at all; its data is in the header sector.
+//
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
 // reading it from disk.
@@ -74,11 +194,23 @@ class FileHeader {
     FileHeader();  // dummy constructor to keep valgrind happy
     ~FileHeader();
 
-    bool Allocate(PersistentBitmap *bitMap, int fileSize);  // Initialize a file header,
-                                                            //  including allocating space
-                                                            //  on disk for the file data
+    static void *operator new(size_t size);  // From a pool of them
+    static void operator delete(void *object);
+
+    static void SetBlockSize(int sectors);  // Allocate data "sectors"
+                                            // sectors at a time
+    static int MaxFileSize();               // Most bytes a file can hold
+
+    bool Allocate(PersistentBitmap *bitMap, int fileSize, int sector);
+    // Initialize a file header, to be
+    //  stored at "sector", the data all
+    //  a hole
     void Deallocate(PersistentBitmap *bitMap);              // De-allocate this file's
                                                             //  data blocks
+    bool Fill(PersistentBitmap *freeMap, int from, int to);  // Allocate sectors for the
+                                                             //  holes in a byte range,
+                                                             //  lengthening the file
+                                                             //  if need be
 
     void FetchFrom(int sectorNumber);  // Initialize file header from disk
     void WriteBack(int sectorNumber);  // Write modifications to file header
@@ -87,11 +219,33 @@ class FileHeader {
     int ByteToSector(int offset);  // Convert a byte offset into the file
                                    // to the disk sector containing
                                    // the byte
+    int ByteToRun(int offset, int maxSectors, int *runLength);
+    // Same, and also return how many of
+    // the following sectors of the file
+    // (up to "maxSectors") are next to it
+    // on disk, or are holes like it
+    int *LeafBlocks(int offset, int *start, int *end);
+    // Pointers to the data blocks around
+    // "offset", from the header or the
+    // index block at level 0, and the
+    // bytes they map (see MapCursor)
+    int MapVersion() { return mapVersion; }
+    // Changes whenever the map does
 
     int FileLength();  // Return the length of the file
                        // in bytes
 
+    bool IsInline();  // Is the data in the header itself?
+    bool IsIndexed() { return !inlined && !extentBased; }
+    // Is it mapped by pointers?
+    void ReadInline(char *into, int numBytes, int position);
+    void WriteInline(char *from, int numBytes, int position);
+    // Transfer bytes of an inline file;
+    // a write may make it longer, up
+    // to MaxInlineBytes
+
     void Print();  // Print the contents of the file.
+    void PrintSpread();  // Print how many tracks the file is on
 
     int GetHeaderSize();
 
@@ -114,17 +268,89 @@ class FileHeader {
     // MP4 start
     int numBytes;                  // Number of bytes in the file
     int numSectors;                // Number of data sectors in the file
+                                   //  (mapped ones, if extent-based)
     int dataSectors[NumPointers];  // Disk sector numbers for each data
                                    // block in the file
     void InitLevel();
+    bool Uninline(PersistentBitmap *freeMap, int from, int to);
+    bool MapExtents(PersistentBitmap *freeMap, int sectors);
+    int Goal(int offset);  // Where to put the sector holding "offset"
+    bool ConvertToIndexed(PersistentBitmap *freeMap, int from, int to);
+    void ExtendIndexed(int newSize, SectorSource *source);
+    void FillIndexed(int from, int to, SectorSource *source);
+    void LevelUp(SectorSource *source);       // Add a level of index blocks
+    int ChildBytes(int i);                    // Bytes under pointer "i"
+    static int LevelFor(int fileSize);        // Levels a file that big needs
+    static int RangeBlocks(int level, int from, int to);
+    // Data and index blocks it takes
+    // to map a byte range
+    bool FillRange(PersistentBitmap *freeMap, int from, int to);
+    // Fill, but for the ends of the
+    // blocks at either end
+    bool IsHole(int offset);                 // Is "offset" in a hole?
+    void ClearSectors(int first, int last);  // Zero file sectors
+                                             // "first" to "last"
+    int hdrSector;              // Where the header is on disk (in-core)
+    int mapVersion;             // Bumped when sectors are mapped or
+                                //  freed (in-core)
+    bool inlined;               // Data kept in the header sector?
+    char inlineData[MaxInlineBytes];  // The data, if so; zeros past
+                                      //  the end of the file
+    bool extentBased;           // Described by extents, not pointers?
+    int numExtents;             // Number of runs in use
+    Extent extents[MaxExtents]; // The runs, in file order; shares the
+                                //  on-disk space of dataSectors
     enum { LDirect,
            LSingle,
            LDouble,
            LTriple
     } level;
     int levelSectors;
-    IndexBlock **nextIndexBlocks;
+    IndexBlock **nextIndexBlocks;  // NULL entries are not loaded yet
+    IndexBlock *Child(int i);      // Index block "i", loading it if need be
     // MP4 end
 };
 
+// The following class maps file offsets to sectors for one OpenFile,
+// without walking down the index blocks for every run of sectors.  It
+// keeps a copy of the pointers it used last, those of one index block
+// at level 0 (or of the header, if it has no index blocks), and
+// looks up offsets there as long as they are in range and the file's
+// map has not changed since.  Sequential access then walks the index
+// blocks once per block of pointers.
+//
+// A file of at most "flatMax" sectors has its whole map copied into
+// one array, so that any offset is found with one index, and runs go
+// on across index blocks.  The copy is made again on the first lookup
+// after the map changes.
+//
+// Inline and extent-based files are looked up in the header; their
+// maps are short already.
+
+class MapCursor {
+   public:
+    MapCursor(FileHeader *hdr, int flatMax);  // Map offsets of "hdr"
+    ~MapCursor();
+
+    static void *operator new(size_t size);  // From a pool of them
+    static void operator delete(void *object);
+
+    int ByteToRun(int offset, int maxSectors, int *runLength);
+    // FileHeader::ByteToRun, from the copy
+
+   private:
+    FileHeader *hdr;  // File whose map we copy
+    int flatMax;      // Largest file, in sectors, to copy the
+                      // whole map of
+    int version;      // hdr->MapVersion() of the copy, -1 if none
+    int start, end;   // Bytes of the file the copy maps
+    int *blocks;      // The copy, or NULL if "start".."end" is
+                      //  a hole
+    int leaf[NumSectorInt];  // Copy of the pointers of one block
+    int *flat;        // Copy of the whole map, if we made one
+
+    void Refill(int offset);  // Copy the map around "offset"
+    void CopyAll();           // Copy the whole map into "flat"
+};
+
 #endif  // FILEHDR_H
@@ -14,30 +14,46 @@
 //	   A directory of file names and file headers
 //
 //      Both the bitmap and the directory are represented as normal
-//	files.  Their file headers are located in specific sectors
-//	(sector 0 and sector 1), so that the file system can find them
-//	on bootup.
+//	files.  Where their file headers are is recorded in the
+//	superblock (cf. superblock.h), in sector 0, so that the file
+//	system can find them on bootup; so is the rest of the layout
+//	chosen when the disk was formatted.
 //
 //	The file system assumes that the bitmap and directory files are
-//	kept "open" continuously while Nachos is running.
+//	kept "open" continuously while Nachos is running.  The bitmap
+//	itself is also kept in memory, and only the parts of it that an
+//	operation changed are written back.
 //
 //	For those operations (such as Create, Remove) that modify the
 //	directory and/or bitmap, if the operation succeeds, the changes
 //	are written immediately back to disk (the two files are kept
 //	open during all this time).  If the operation fails, and we have
 //	modified part of the directory and/or bitmap, we simply discard
-//	the changed version, without writing it back to disk.
+//	the changed version, without writing it back to disk (for the
+//	in-core bitmap, by re-reading the parts we changed).
+//
+//	Every sector such an operation writes goes through the journal
+//	(cf. journal.h), by default a track's worth of sectors right after
+//	the bitmap and directory headers: the changes of several operations are
+//	committed to it together, in one sequential write, and only then
+//	written back to their homes.  When the disk is mounted, what was
+//	committed before a crash is replayed.
+//
+//	Path names are resolved one component at a time through the
+//	dentry cache (cf. dcache.h); a directory is only read when a
+//	name in it is not cached, or when it is about to be changed.
 //
 // 	Our implementation at this point has the following restrictions:
 //
 //	   there is no synchronization for concurrent accesses
-//	   files have a fixed size, set when the file is created
-//	   files cannot be bigger than about 3KB in size
-//	   there is no hierarchical directory structure, and only a limited
-//	     number of files can be added to the system
-//	   there is no attempt to make the system robust to failures
-//	    (if Nachos exits in the middle of an operation that modifies
-//	    the file system, it may corrupt the disk)
+//	   a file can be no bigger than its levels of index blocks map
+//	     (cf. FileHeader::MaxFileSize)
+//	   file names are at most FileNameMaxLen characters long, and a
+//	     directory has at most MaxDirPages sectors of them (cf.
+//	     directory.h)
+//	   only the file system's own data is journaled; the contents of
+//	    files written just before a crash may be lost (and operations
+//	    changing more than JournalMax sectors are committed in pieces)
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -47,26 +63,27 @@
 #include "filesys.h"
 
 #include "copyright.h"
+#include "dcache.h"
 #include "debug.h"
 #include "directory.h"
 #include "disk.h"
 #include "filehdr.h"
+#include "inode.h"
+#include "journal.h"
+#include "main.h"
 #include "pbitmap.h"
+#include "pool.h"
+#include "superblock.h"
 
-// Sectors containing the file headers for the bitmap of free sectors,
-// and the directory of files.  These file headers are placed in well-known
-// sectors, so that they can be located on boot-up.
-#define FreeMapSector 0
-#define DirectorySector 1
-
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number
-// of files that can be loaded onto the disk.
+// Initial file size for the bitmap.  A directory starts out with room
+// for as many files as the superblock says, and its file grows as more
+// are added.
 #define FreeMapFileSize (NumSectors / BitsInByte)
-// MP4 start
-#define NumDirEntries 64
-// MP4 end
-#define DirectoryFileSize (sizeof(DirectoryEntry) * NumDirEntries)
+
+// Every call taking a path copies it to a buffer of this size, to be
+// cut up into names; the buffers come from a pool.
+#define PathBufferSize 256
+static Pool pathPool("path buffers", PathBufferSize, 8);
 
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
@@ -75,32 +92,58 @@
 //	an empty directory, and a bitmap of free sectors (with almost but
 //	not all of the sectors marked as free).
 //
-//	If format = FALSE, we just have to open the files
-//	representing the bitmap and the directory.
+//	If format = FALSE, we read the superblock to find out where
+//	everything is, and replay the journal, in case we crashed in the
+//	middle of changing the file system; then we just have to open the
+//	files representing the bitmap and the directory, and read in the
+//	bitmap.
 //
 //	"format" -- should we initialize the disk?
+//	"dirEntries" -- if formatting, how many entries a new directory
+//		has room for (0 for the default)
+//	"journalSize" -- if formatting, how many sectors the journal
+//		takes (0 for the default)
+//	"blockSectors" -- if formatting, how many sectors file data is
+//		allocated at a time (0 for the default)
 //----------------------------------------------------------------------
 
-FileSystem::FileSystem(bool format) {
+FileSystem::FileSystem(bool format, int dirEntries, int journalSize, int blockSectors) {
     DEBUG(dbgFile, "Initializing the file system.");
+    super = new Superblock;
     if (format) {
-        PersistentBitmap *freeMap = new PersistentBitmap(NumSectors);
-        Directory *directory = new Directory(NumDirEntries);
+        if (dirEntries > 0)
+            super->dirEntries = dirEntries;
+        if (journalSize > 0)
+            super->journalSize = journalSize;
+        if (blockSectors > 0)
+            super->sectorsPerBlock = blockSectors;
+        FileHeader::SetBlockSize(super->sectorsPerBlock);
+        freeMap = new PersistentBitmap(NumSectors);
+        freeMap->SetBlockSize(super->sectorsPerBlock);
+        journal = new Journal(super->journalSector, super->journalSize);
+        Directory *directory = new Directory(super->dirEntries);
         FileHeader *mapHdr = new FileHeader;
         FileHeader *dirHdr = new FileHeader;
 
         DEBUG(dbgFile, "Formatting the file system.");
 
-        // First, allocate space for FileHeaders for the directory and bitmap
-        // (make sure no one else grabs these!)
-        freeMap->Mark(FreeMapSector);
-        freeMap->Mark(DirectorySector);
+        // First, allocate space for the superblock, the FileHeaders for the
+        // directory and bitmap, and the journal (make sure no one else grabs
+        // these!)
+        freeMap->Mark(SuperblockSector);
+        freeMap->Mark(super->freeMapSector);
+        freeMap->Mark(super->directorySector);
+        for (int i = 0; i < super->journalSize; i++)
+            freeMap->Mark(super->journalSector + i);
 
         // Second, allocate space for the data blocks containing the contents
         // of the directory and bitmap files.  There better be enough space!
+        // (They are written before there is a file system to fill holes.)
 
-        ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize));
-        ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize));
+        ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize, super->freeMapSector));
+        ASSERT(mapHdr->Fill(freeMap, 0, FreeMapFileSize));
+        ASSERT(dirHdr->Allocate(freeMap, directory->FileLength(), super->directorySector));
+        ASSERT(dirHdr->Fill(freeMap, 0, directory->FileLength()));
 
         // Flush the bitmap and directory FileHeaders back to disk
         // We need to do this before we can "Open" the file, since open
@@ -108,40 +151,55 @@ FileSystem::FileSystem(bool format) {
         // on it!).
 
         DEBUG(dbgFile, "Writing headers back to disk.");
-        mapHdr->WriteBack(FreeMapSector);
-        dirHdr->WriteBack(DirectorySector);
+        mapHdr->WriteBack(super->freeMapSector);
+        dirHdr->WriteBack(super->directorySector);
 
         // OK to open the bitmap and directory files now
         // The file system operations assume these two files are left open
         // while Nachos is running.
 
-        freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        freeMapFile = new OpenFile(super->freeMapSector);
+        directoryFile = new OpenFile(super->directorySector);
 
         // Once we have the files "open", we can write the initial version
         // of each file back to disk.  The directory at this point is completely
         // empty; but the bitmap has been changed to reflect the fact that
         // sectors on the disk have been allocated for the file headers and
-        // to hold the file data for the directory and bitmap.
+        // to hold the file data for the directory and bitmap.  Writing the
+        // bitmap also writes the superblock, with how much of it is free.
 
         DEBUG(dbgFile, "Writing bitmap and directory back to disk.");
-        freeMap->WriteBack(freeMapFile);  // flush changes to disk
+        WriteFreeMap();  // flush changes to disk
         directory->WriteBack(directoryFile);
 
+        journal->Format();
+
         if (debug->IsEnabled('f')) {
             freeMap->Print();
             directory->Print();
         }
-        delete freeMap;
         delete directory;
         delete mapHdr;
         delete dirHdr;
     } else {
-        // if we are not formatting the disk, just open the files representing
-        // the bitmap and directory; these are left open while Nachos is running
-        freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        // if we are not formatting the disk, find out where the journal is,
+        // bring the disk up to date from it (the superblock too), and just
+        // open the files representing the bitmap and directory; these are
+        // left open while Nachos is running
+        bool mountable = super->FetchFrom(SuperblockSector);
+        ASSERT(mountable);  // formatted, and by this build of Nachos
+        FileHeader::SetBlockSize(super->sectorsPerBlock);
+        journal = new Journal(super->journalSector, super->journalSize);
+        journal->Recover();
+        super->FetchFrom(SuperblockSector);
+        freeMapFile = new OpenFile(super->freeMapSector);
+        directoryFile = new OpenFile(super->directorySector);
+        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+        freeMap->SetBlockSize(super->sectorsPerBlock);
+        ASSERT(freeMap->NumClear() == super->numFree);
     }
+    dcache = new DentryCache();
+    kernel->synchDisk->SetJournal(journal);
 }
 
 //----------------------------------------------------------------------
@@ -149,46 +207,112 @@ FileSystem::FileSystem(bool format) {
 // FileSystem::~FileSystem
 //----------------------------------------------------------------------
 FileSystem::~FileSystem() {
+    delete journal;
+    delete super;
+    delete dcache;
+    delete freeMap;
     delete freeMapFile;
     delete directoryFile;
 }
 
-void Parser(OpenFile *directoryFile, Directory *&directory, OpenFile *&dirFile, char *&token, int &sector, char *name) {
+//----------------------------------------------------------------------
+// FetchDirectory
+// 	Read the directory whose header is at "parent" into "directory",
+//	unless it is there already.  "dirFile" is left open on it.
+//
+//	"fetched" -- header sector of the directory in "directory", or -1
+//	"root" -- header sector of the root directory, "directoryFile"
+//----------------------------------------------------------------------
+
+static void FetchDirectory(OpenFile *directoryFile, int root, Directory *directory,
+                           OpenFile *&dirFile, int &fetched, int parent) {
+    if (fetched == parent)
+        return;
+    if (dirFile != directoryFile)
+        delete dirFile;
+    dirFile = (parent == root) ? directoryFile : new OpenFile(parent);
+    directory->FetchFrom(dirFile);
+    fetched = parent;
+}
+
+//----------------------------------------------------------------------
+// EmptiestGroup
+// 	Return the first sector of the allocation group with the most
+//	free sectors, where a new directory should go so that directories
+//	(and the files in them) are spread over the disk.
+//----------------------------------------------------------------------
+
+static int EmptiestGroup(PersistentBitmap *freeMap) {
+    int best = 0, bestFree = -1;
+
+    for (int g = 0; g < NumGroups; g++) {
+        int numFree = freeMap->NumClear(g * SectorsPerGroup, (g + 1) * SectorsPerGroup);
+
+        if (numFree > bestFree) {
+            best = g;
+            bestFree = numFree;
+        }
+    }
+    return best * SectorsPerGroup;
+}
+
+//----------------------------------------------------------------------
+// Parser
+// 	Resolve the path "name", one component at a time, starting at
+//	the root directory, whose header is at "root".  On return,
+//	"token" is the last component that was looked up, "parent" the
+//	header sector of the directory it was looked up in, and "sector"
+//	the header sector it names (-1 if there is none).  If "fetch",
+//	that directory is also read into "directory", and "dirFile" is
+//	left open on it, for the caller to change.
+//
+//	Each name is looked up in the dentry cache first; the directory
+//	is only read if the name is not cached, and what it says is then
+//	entered in the cache.
+//
+//	"name" is changed (by strtok).
+//----------------------------------------------------------------------
+
+void Parser(OpenFile *directoryFile, int root, DentryCache *dcache, Directory *&directory,
+            OpenFile *&dirFile, char *&token, int &parent, int &sector, char *name, bool fetch) {
     DEBUG(dbgFile, "Parser(" << name << ")");
+    int fetched = -1;
+    bool isDir;
     char *next;
 
     dirFile = directoryFile;
-
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(dirFile);
+    directory = new Directory(DefaultDirEntries);  // size is read from disk
+    parent = root;
+    sector = -1;
 
     token = strtok(name, "/");
-    if (token != NULL) {
+    while (token != NULL) {
         next = strtok(NULL, "/");
-        sector = directory->Find(token);
-        while (next != NULL && sector != -1) {
-            if (dirFile != directoryFile)
-                delete dirFile;
-            dirFile = new OpenFile(sector);
-            directory->FetchFrom(dirFile);
-
-            token = next;
-            next = strtok(NULL, "/");
+        if (!dcache->Lookup(parent, token, &sector, &isDir)) {
+            FetchDirectory(directoryFile, root, directory, dirFile, fetched, parent);
             sector = directory->Find(token);
+            dcache->Enter(parent, token, sector, directory->IsDir(token));
         }
+        if (next == NULL || sector == -1)
+            break;
+        parent = sector;
+        token = next;
     }
+    if (fetch)
+        FetchDirectory(directoryFile, root, directory, dirFile, fetched, parent);
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Create
 // 	Create a file in the Nachos file system (similar to UNIX create).
-//	Since we can't increase the size of files dynamically, we have
-//	to give Create the initial size of the file.
+//	The file starts out "initialSize" bytes long, all of it a hole:
+//	no data blocks are allocated until it is written (cf. Fill), and
+//	writing past the end makes it longer, so this may be 0.
 //
 //	The steps to create a file are:
 //	  Make sure the file doesn't already exist
-//        Allocate a sector for the file header
-// 	  Allocate space on disk for the data blocks for the file
+//        Allocate a sector for the file header, in the allocation
+//	    group of its directory
 //	  Add the name to the directory
 //	  Store the new file header on disk
 //	  Flush the changes to the bitmap and the directory back to disk
@@ -198,8 +322,8 @@ void Parser(OpenFile *directoryFile, Directory *&directory, OpenFile *&dirFile,
 // 	Create fails if:
 //   		file is already in directory
 //	 	no free space for file header
-//	 	no free entry for file in directory
-//	 	no free space for data blocks for the file
+//	 	no room for file in directory
+//	 	file bigger than MaxFileSize()
 //
 // 	Note that this implementation assumes there is no concurrent access
 //	to the file system!
@@ -210,107 +334,119 @@ void Parser(OpenFile *directoryFile, Directory *&directory, OpenFile *&dirFile,
 
 bool FileSystem::Create(char *name, int initialSize) {
     DEBUG(dbgFile, "Create(" << name << ", " << initialSize << ")");
-    char *duplicate = new char[256];
+    char *duplicate = (char *)pathPool.Get();
     strcpy(duplicate, name);
 
     Directory *directory;
-    PersistentBitmap *freeMap;
     FileHeader *hdr;
     OpenFile *dirFile;
     char *token;
-    int sector;
+    int parent, sector;
     bool success;
 
     DEBUG(dbgFile, "Creating file " << name << " size " << initialSize);
 
-    Parser(directoryFile, directory, dirFile, token, sector, duplicate);
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, TRUE);
 
+    journal->Begin();
     if (sector != -1)
         success = FALSE;  // file is already in directory
     else {
-        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-        sector = freeMap->FindAndSet();  // find a sector to hold the file header
+        sector = freeMap->FindAndSetNear(parent);  // find a sector to hold the file header
         if (sector == -1)
             success = FALSE;  // no free block for file header
         else if (!directory->Add(token, sector))
             success = FALSE;  // no space in directory
         else {
             hdr = new FileHeader;
-            if (!hdr->Allocate(freeMap, initialSize))
-                success = FALSE;  // no space on disk for data
+            if (!hdr->Allocate(freeMap, initialSize, sector))
+                success = FALSE;  // file too big
+            else if (!dirFile->Fill(freeMap, dirFile->Length(), directory->FileLength()))
+                success = FALSE;  // no space to grow the directory
             else {
                 success = TRUE;
                 // everthing worked, flush all changes back to disk
                 hdr->WriteBack(sector);
                 directory->WriteBack(dirFile);
-                freeMap->WriteBack(freeMapFile);
+                WriteFreeMap();
+                dcache->Enter(parent, token, sector, FALSE);
             }
             delete hdr;
         }
-        delete freeMap;
+        if (!success)
+            freeMap->Revert(freeMapFile);  // undo any allocations
     }
+    journal->End();
 
     if (dirFile != directoryFile)
         delete dirFile;
     delete directory;
-    delete duplicate;
+    pathPool.Put(duplicate);
     return success;
 }
 
 // MP4 start
 bool FileSystem::CreateDirectory(char *name) {
     DEBUG(dbgFile, "CreateDirectory(" << name << ")");
-    char *duplicate = new char[256];
+    char *duplicate = (char *)pathPool.Get();
     strcpy(duplicate, name);
 
     Directory *directory;
-    PersistentBitmap *freeMap;
     FileHeader *hdr;
     OpenFile *dirFile;
     char *token;
-    int sector;
+    int parent, sector;
     bool success;
 
     DEBUG(dbgFile, "Creating Directory " << name);
 
-    Parser(directoryFile, directory, dirFile, token, sector, duplicate);
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, TRUE);
 
+    journal->Begin();
     if (sector != -1)
         success = FALSE;
     else {
-        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-        sector = freeMap->FindAndSet();
+        sector = freeMap->FindAndSetNear(EmptiestGroup(freeMap));
         if (sector == -1)
             success = FALSE;
         else if (!directory->AddDirectory(token, sector))
             success = FALSE;
         else {
+            Directory *newDir = new Directory(super->dirEntries);
+
             hdr = new FileHeader;
-            if (!hdr->Allocate(freeMap, DirectoryFileSize))
+            if (!hdr->Allocate(freeMap, newDir->FileLength(), sector) ||
+                !hdr->Fill(freeMap, 0, newDir->FileLength()))
+                success = FALSE;
+            else if (!dirFile->Fill(freeMap, dirFile->Length(), directory->FileLength()))
                 success = FALSE;
             else {
                 success = TRUE;
                 hdr->WriteBack(sector);
 
                 OpenFile *newDirFile = new OpenFile(sector);
-                Directory *newDir = new Directory(NumDirEntries);
                 newDir->WriteBack(newDirFile);
 
                 directory->WriteBack(dirFile);
-                freeMap->WriteBack(freeMapFile);
+                WriteFreeMap();
+                dcache->Enter(parent, token, sector, TRUE);
 
                 delete newDirFile;
-                delete newDir;
             }
+            delete newDir;
             delete hdr;
         }
-        delete freeMap;
+        if (!success)
+            freeMap->Revert(freeMapFile);
     }
+    journal->End();
 
     if (dirFile != directoryFile)
         delete dirFile;
     delete directory;
-    delete duplicate;
+    pathPool.Put(duplicate);
     return success;
 }
 // MP4 end
@@ -327,18 +463,19 @@ bool FileSystem::CreateDirectory(char *name) {
 
 OpenFile *FileSystem::Open(char *name) {
     DEBUG(dbgFile, "Open(" << name << ")");
-    char *duplicate = new char[256];
+    char *duplicate = (char *)pathPool.Get();
     strcpy(duplicate, name);
 
     Directory *directory;
     OpenFile *openFile = NULL;
     OpenFile *dirFile;
     char *token;
-    int sector;
+    int parent, sector;
 
     DEBUG(dbgFile, "Opening file" << name);
 
-    Parser(directoryFile, directory, dirFile, token, sector, duplicate);
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, FALSE);
 
     if (sector >= 0)
         openFile = new OpenFile(sector);  // name was found in directory
@@ -346,43 +483,35 @@ OpenFile *FileSystem::Open(char *name) {
     if (dirFile != directoryFile)
         delete dirFile;
     delete directory;
-    delete duplicate;
+    pathPool.Put(duplicate);
     return openFile;  // return NULL if not found
 }
 
-// MP4 Start
-OpenFileId FileSystem::OpenAFile(char *name) {
-    OpenFileId id = 0;
-    fileDescriptorTable[id] = Open(name);
-    return id;
-}
-
-int FileSystem::WriteFile(char *buffer, int size, OpenFileId id) {
-    if (id != 0)
-        return -1;
-    int retVal = fileDescriptorTable[id]->Write(buffer, size);
-    if (retVal < 0)
-        return -1;
-    return retVal;
-}
+//----------------------------------------------------------------------
+// FileSystem::Fill
+// 	Allocate disk sectors for the holes between bytes "from" and "to"
+//	of an open file, which is about to be written there, making it
+//	longer if need be; then write the changed bitmap back to disk.
+//	Return FALSE, leaving the file and the bitmap as they were, if
+//	the disk is full.
+//
+//	"file" -- the file to fill
+//	"from", "to" -- the byte range
+//----------------------------------------------------------------------
 
-int FileSystem::ReadFile(char *buffer, int size, OpenFileId id) {
-    if (id != 0)
-        return -1;
-    int retVal = fileDescriptorTable[id]->Read(buffer, size);
-    if (retVal < 0)
-        return -1;
-    return retVal;
-}
+bool FileSystem::Fill(OpenFile *file, int from, int to) {
+    bool success;
 
-int FileSystem::CloseFile(OpenFileId id) {
-    if (id != 0 || fileDescriptorTable[id] == NULL)
-        return -1;
-    delete fileDescriptorTable[id];
-    fileDescriptorTable[id] = NULL;
-    return 1;
+    DEBUG(dbgFile, "Filling bytes " << from << " to " << to << " of a file");
+    journal->Begin();
+    success = file->Fill(freeMap, from, to);
+    if (success)
+        WriteFreeMap();
+    else
+        freeMap->Revert(freeMapFile);
+    journal->End();
+    return success;
 }
-// MP4 end
 
 //----------------------------------------------------------------------
 // FileSystem::Remove
@@ -401,40 +530,43 @@ int FileSystem::CloseFile(OpenFileId id) {
 // MP4 start
 bool FileSystem::Remove(char *name) {
     DEBUG(dbgFile, "Remove(" << name << ")");
-    char *duplicate = new char[256];
+    char *duplicate = (char *)pathPool.Get();
     strcpy(duplicate, name);
 
     Directory *directory;
-    PersistentBitmap *freeMap;
-    FileHeader *fileHdr;
+    Inode *inode;
     OpenFile *dirFile;
     char *token;
-    int sector;
+    int parent, sector;
 
-    Parser(directoryFile, directory, dirFile, token, sector, duplicate);
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, TRUE);
 
     if (sector == -1) {
+        if (dirFile != directoryFile)
+            delete dirFile;
         delete directory;
+        pathPool.Put(duplicate);
         return FALSE;  // file not found
     }
-    fileHdr = new FileHeader;
-    fileHdr->FetchFrom(sector);
-
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-
-    fileHdr->Deallocate(freeMap);  // remove data blocks
-    freeMap->Clear(sector);        // remove header block
+    journal->Begin();
+    inode = kernel->inodeTable->Get(sector);
+    inode->hdr->Deallocate(freeMap);  // remove data blocks
+    freeMap->Clear(sector);           // remove header block
+    kernel->inodeTable->Release(inode);
+    kernel->inodeTable->Forget(sector);
     directory->Remove(token);
 
-    freeMap->WriteBack(freeMapFile);  // flush to disk
+    WriteFreeMap();  // flush to disk
     directory->WriteBack(dirFile);    // flush to disk
+    journal->End();
+    dcache->Enter(parent, token, -1, FALSE);
+    dcache->Purge(sector);  // in case it was a directory
 
     if (dirFile != directoryFile)
         delete dirFile;
-    delete fileHdr;
     delete directory;
-    delete freeMap;
-    delete duplicate;
+    pathPool.Put(duplicate);
     return TRUE;
 }
 // MP4 end
@@ -442,49 +574,54 @@ bool FileSystem::Remove(char *name) {
 // MP4 start
 bool FileSystem::RecursiveRemove(char *name) {
     DEBUG(dbgFile, "RecursiveRemove(" << name << ")");
-    char *duplicate = new char[256];
+    char *duplicate = (char *)pathPool.Get();
     strcpy(duplicate, name);
 
     Directory *directory;
-    PersistentBitmap *freeMap;
-    FileHeader *fileHdr;
+    Inode *inode;
     OpenFile *dirFile;
     char *token;
-    int sector;
+    int parent, sector;
 
-    Parser(directoryFile, directory, dirFile, token, sector, duplicate);
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, TRUE);
 
     if (sector == -1) {
+        if (dirFile != directoryFile)
+            delete dirFile;
         delete directory;
+        pathPool.Put(duplicate);
         return FALSE;  // file not found
     }
 
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-
+    journal->Begin();
     if (directory->IsDir(token)) {
         OpenFile *subDirFile = new OpenFile(sector);
-        Directory *subDir = new Directory(NumDirEntries);
+        Directory *subDir = new Directory(super->dirEntries);
         subDir->FetchFrom(subDirFile);
 
         subDir->RecursiveRemove(freeMap);
+        delete subDir;
+        delete subDirFile;
+        dcache->Clear();  // forget the whole tree
     }
 
-    fileHdr = new FileHeader;
-    fileHdr->FetchFrom(sector);
-
-    fileHdr->Deallocate(freeMap);
+    inode = kernel->inodeTable->Get(sector);
+    inode->hdr->Deallocate(freeMap);
     freeMap->Clear(sector);
+    kernel->inodeTable->Release(inode);
+    kernel->inodeTable->Forget(sector);
     directory->Remove(token);
 
-    freeMap->WriteBack(freeMapFile);
+    WriteFreeMap();
     directory->WriteBack(dirFile);
+    journal->End();
+    dcache->Enter(parent, token, -1, FALSE);
 
     if (dirFile != directoryFile)
         delete dirFile;
-    delete fileHdr;
-    delete freeMap;
     delete directory;
-    delete duplicate;
+    pathPool.Put(duplicate);
     return TRUE;
 }
 // MP4 end
@@ -496,15 +633,16 @@ bool FileSystem::RecursiveRemove(char *name) {
 
 void FileSystem::List(char *name) {
     DEBUG(dbgFile, "List(" << name << ")");
-    char *duplicate = new char[256];
+    char *duplicate = (char *)pathPool.Get();
     strcpy(duplicate, name);
 
     Directory *directory;
     OpenFile *dirFile;
     char *token;
-    int sector;
+    int parent, sector;
 
-    Parser(directoryFile, directory, dirFile, token, sector, duplicate);
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, TRUE);
 
     if (token != NULL) {
         if (dirFile != directoryFile)
@@ -518,21 +656,22 @@ void FileSystem::List(char *name) {
     if (dirFile != directoryFile)
         delete dirFile;
     delete directory;
-    delete duplicate;
+    pathPool.Put(duplicate);
 }
 
 // MP4 start
 void FileSystem::RecursiveList(char *name) {
     DEBUG(dbgFile, "RecursiveList(" << name << ")");
-    char *duplicate = new char[256];
+    char *duplicate = (char *)pathPool.Get();
     strcpy(duplicate, name);
 
     Directory *directory;
     OpenFile *dirFile;
     char *token;
-    int sector;
+    int parent, sector;
 
-    Parser(directoryFile, directory, dirFile, token, sector, duplicate);
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, TRUE);
 
     if (token != NULL) {
         if (dirFile != directoryFile)
@@ -546,13 +685,73 @@ void FileSystem::RecursiveList(char *name) {
     if (dirFile != directoryFile)
         delete dirFile;
     delete directory;
-    delete duplicate;
+    pathPool.Put(duplicate);
 }
 // MP4 end
 
+//----------------------------------------------------------------------
+// FileSystem::PrintSpread
+// 	List every file under the directory "name", like RecursiveList,
+//	with how many tracks it is spread over (see
+//	FileHeader::PrintSpread).
+//----------------------------------------------------------------------
+
+void FileSystem::PrintSpread(char *name) {
+    DEBUG(dbgFile, "PrintSpread(" << name << ")");
+    char *duplicate = (char *)pathPool.Get();
+    strcpy(duplicate, name);
+
+    Directory *directory;
+    OpenFile *dirFile;
+    char *token;
+    int parent, sector;
+
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, TRUE);
+
+    if (token != NULL) {
+        if (dirFile != directoryFile)
+            delete dirFile;
+        dirFile = new OpenFile(sector);
+        directory->FetchFrom(dirFile);
+    }
+
+    directory->PrintSpread(0);
+
+    if (dirFile != directoryFile)
+        delete dirFile;
+    delete directory;
+    pathPool.Put(duplicate);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WriteFreeMap
+// 	Write the changed parts of the bitmap back to disk, and the
+//	superblock with the number of free sectors it now has.  Since
+//	both are written by the same operation, the journal keeps them
+//	in step.
+//----------------------------------------------------------------------
+
+void FileSystem::WriteFreeMap() {
+    freeMap->WriteBack(freeMapFile);
+    super->numFree = freeMap->NumClear();
+    super->WriteBack(SuperblockSector);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::PrintUsage
+// 	Print how the disk is laid out, and how much of it is free (like
+//	UNIX df), from the superblock alone.
+//----------------------------------------------------------------------
+
+void FileSystem::PrintUsage() {
+    super->Print();
+}
+
 //----------------------------------------------------------------------
 // FileSystem::Print
 // 	Print everything about the file system:
+//	  the superblock
 //	  the contents of the bitmap
 //	  the contents of the directory
 //	  for each file in the directory,
@@ -563,15 +762,16 @@ void FileSystem::RecursiveList(char *name) {
 void FileSystem::Print() {
     FileHeader *bitHdr = new FileHeader;
     FileHeader *dirHdr = new FileHeader;
-    PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-    Directory *directory = new Directory(NumDirEntries);
+    Directory *directory = new Directory(super->dirEntries);
+
+    super->Print();
 
     printf("Bit map file header:\n");
-    bitHdr->FetchFrom(FreeMapSector);
+    bitHdr->FetchFrom(super->freeMapSector);
     bitHdr->Print();
 
     printf("Directory file header:\n");
-    dirHdr->FetchFrom(DirectorySector);
+    dirHdr->FetchFrom(super->directorySector);
     dirHdr->Print();
 
     freeMap->Print();
@@ -581,7 +781,6 @@ void FileSystem::Print() {
 
     delete bitHdr;
     delete dirHdr;
-    delete freeMap;
     delete directory;
 }
 
@@ -594,16 +793,17 @@ void FileSystem::Print() {
 // }
 
 void FileSystem::PrintFileHdrSize(char *name) {
-    char *duplicate = new char[256];
+    char *duplicate = (char *)pathPool.Get();
     strcpy(duplicate, name);
 
     Directory *directory;
     OpenFile *dirFile;
     FileHeader *hdr = new FileHeader;
     char *token;
-    int sector;
+    int parent, sector;
 
-    Parser(directoryFile, directory, dirFile, token, sector, duplicate);
+    Parser(directoryFile, super->directorySector, dcache, directory, dirFile, token, parent, sector,
+           duplicate, FALSE);
 
     hdr->FetchFrom(sector);
     printf("Header Size: %d\n", hdr->GetHeaderSize());
@@ -612,7 +812,7 @@ void FileSystem::PrintFileHdrSize(char *name) {
         delete dirFile;
     delete hdr;
     delete directory;
-    delete duplicate;
+    pathPool.Put(duplicate);
 }
 
 #endif  // FILESYS_STUB
@@ -37,6 +37,11 @@
 #include "openfile.h"
 #include "sysdep.h"
 
+class PersistentBitmap;
+class DentryCache;
+class Journal;
+class Superblock;
+
 typedef int OpenFileId;
 
 #ifdef FILESYS_STUB  // Temporarily implement file system calls as
@@ -121,12 +126,14 @@ class FileSystem {
 #else  // FILESYS
 class FileSystem {
    public:
-    FileSystem(bool format);  // Initialize the file system.
-                              // Must be called *after* "synchDisk"
-                              // has been initialized.
-                              // If "format", there is nothing on
-                              // the disk, so initialize the directory
-                              // and the bitmap of free blocks.
+    FileSystem(bool format, int dirEntries = 0, int journalSize = 0, int blockSectors = 0);
+    // Initialize the file system.
+    // Must be called *after* "synchDisk"
+    // has been initialized.
+    // If "format", there is nothing on
+    // the disk, so initialize the directory
+    // and the bitmap of free blocks, laid
+    // out as the other arguments say.
     // MP4 mod tag
     ~FileSystem();
 
@@ -135,15 +142,10 @@ class FileSystem {
 
     OpenFile *Open(char *name);  // Open a file (UNIX open)
 
-    // MP4 Start
-    OpenFileId OpenAFile(char *name);
-
-    int WriteFile(char *buffer, int size, OpenFileId id);
-
-    int ReadFile(char *buffer, int size, OpenFileId id);
-
-    int CloseFile(OpenFileId id);
-    // MP4 End
+    bool Fill(OpenFile *file, int from, int to);
+    // Allocate sectors for part of an
+    // open file, making it longer if
+    // need be
 
     bool Remove(char *name);  // Delete a file (UNIX unlink)
 
@@ -159,12 +161,24 @@ class FileSystem {
 
     void RecursiveList(char *name);
 
+    void PrintSpread(char *name);  // List files with the tracks they
+                                   // are on
+
+    void PrintUsage();  // Print the layout, and the free space
+
    private:
     OpenFile *freeMapFile;    // Bit map of free disk blocks,
                               // represented as a file
+    PersistentBitmap *freeMap;  // In-core copy of the bit map,
+                                // kept for as long as we are mounted
     OpenFile *directoryFile;  // "Root" directory -- list of
                               // file names, represented as a file
-    OpenFile *fileDescriptorTable[1];
+    DentryCache *dcache;      // What path names resolved to
+    Journal *journal;         // Where metadata changes are committed
+    Superblock *super;        // How the disk is laid out
+
+    void WriteFreeMap();  // Write back the bitmap, and how much
+                          // of the disk is free
 };
 
 #endif  // FILESYS
@@ -0,0 +1,144 @@
+// inode.cc
+//	Routines to manage the in-core inode table.
+//
+//	Opening a file used to read its header into a private copy, so a
+//	file opened N times was held (and its index blocks read) N times.
+//	Now every OpenFile on a file shares one header, found through a
+//	hash table on the header sector, and a change one of them makes
+//	to the header (such as growing the file) is seen by the others.
+//
+//	An inode whose last user releases it stays in the table, on the
+//	"unused" list, until InodeCacheSize others have been released
+//	after it; opening the file again meanwhile costs no header I/O.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "inode.h"
+
+#include "copyright.h"
+#include "debug.h"
+
+//----------------------------------------------------------------------
+// InodeTable::InodeTable
+// 	Initialize an empty inode table.
+//----------------------------------------------------------------------
+
+InodeTable::InodeTable() {
+    for (int i = 0; i < InodeBuckets; i++)
+        buckets[i] = NULL;
+    unused = new List<Inode *>;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::~InodeTable
+// 	De-allocate the table, and the inodes nobody uses.
+//----------------------------------------------------------------------
+
+InodeTable::~InodeTable() {
+    while (!unused->IsEmpty()) {
+        Inode *inode = unused->RemoveFront();
+        delete inode->hdr;
+        delete inode;
+    }
+    delete unused;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Get
+// 	Return the inode for the header at "sector", reading the header
+//	in if it is not in the table, and count one more user.
+//----------------------------------------------------------------------
+
+Inode *InodeTable::Get(int sector) {
+    Inode *inode = Find(sector);
+
+    if (inode == NULL) {
+        inode = new Inode;
+        inode->sector = sector;
+        inode->refCount = 0;
+        inode->hdr = new FileHeader;
+        inode->hdr->FetchFrom(sector);
+        inode->hashed = TRUE;
+        inode->hashNext = buckets[sector % InodeBuckets];
+        buckets[sector % InodeBuckets] = inode;
+    } else if (inode->refCount == 0) {
+        unused->Remove(inode);
+    }
+    inode->refCount++;
+    return inode;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Release
+// 	Count one user less.  The last user puts the inode on the unused
+//	list, and the inode released longest ago is dropped if the list
+//	is full.  An inode that has been forgotten is dropped at once.
+//----------------------------------------------------------------------
+
+void InodeTable::Release(Inode *inode) {
+    ASSERT(inode->refCount > 0);
+    if (--inode->refCount > 0)
+        return;
+    if (!inode->hashed) {
+        delete inode->hdr;
+        delete inode;
+        return;
+    }
+    unused->Append(inode);
+    if ((int)unused->NumInList() > InodeCacheSize) {
+        inode = unused->RemoveFront();
+        Unhash(inode);
+        delete inode->hdr;
+        delete inode;
+    }
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Forget
+// 	Drop the inode for "sector" from the table, because the header
+//	there has been freed.  If it is still in use, it is deleted when
+//	the last user releases it.
+//----------------------------------------------------------------------
+
+void InodeTable::Forget(int sector) {
+    Inode *inode = Find(sector);
+
+    if (inode == NULL)
+        return;
+    Unhash(inode);
+    if (inode->refCount == 0) {
+        unused->Remove(inode);
+        delete inode->hdr;
+        delete inode;
+    }
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Find
+// 	Return the inode for "sector", or NULL if it is not in the table.
+//----------------------------------------------------------------------
+
+Inode *InodeTable::Find(int sector) {
+    Inode *inode;
+
+    for (inode = buckets[sector % InodeBuckets]; inode != NULL; inode = inode->hashNext)
+        if (inode->sector == sector)
+            return inode;
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// InodeTable::Unhash
+// 	Take an inode off its hash chain.
+//----------------------------------------------------------------------
+
+void InodeTable::Unhash(Inode *inode) {
+    Inode **prev;
+
+    for (prev = &buckets[inode->sector % InodeBuckets]; *prev != inode; prev = &(*prev)->hashNext)
+        ;
+    *prev = inode->hashNext;
+    inode->hashed = FALSE;
+}
@@ -0,0 +1,63 @@
+// inode.h
+//	Data structures for the in-core inode table, which holds one copy
+//	of the header of each open file, shared by every OpenFile on it.
+//
+//	We assume mutual exclusion is provided by the caller.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef INODE_H
+#define INODE_H
+
+#include "filehdr.h"
+#include "list.h"
+
+// Size of the inode table.  Headers of files that are no longer open
+// are kept too, up to InodeCacheSize of them, in case the file is
+// opened again soon.
+const int InodeBuckets = 61;     // number of hash chains
+const int InodeCacheSize = 32;   // headers kept once nobody uses them
+
+// The following class defines an in-core inode: a file header, read
+// in from "sector", and how many OpenFiles use it.
+//
+// Internal data structures kept public so that InodeTable can access
+// them directly.
+
+class Inode {
+   public:
+    int sector;        // Where the header is on disk
+    int refCount;      // Number of users
+    bool hashed;       // In the table?  FALSE once forgotten
+    FileHeader *hdr;   // The header
+    Inode *hashNext;   // Next inode on the same hash chain
+};
+
+// The following class defines the inode table.  Get returns the inode
+// for a header sector, reading the header the first time, and
+// Release gives it back.  Whoever frees a header sector must call
+// Forget, so that a header later written there is read afresh.
+
+class InodeTable {
+   public:
+    InodeTable();   // Initialize an empty table
+    ~InodeTable();  // De-allocate the table
+
+    Inode *Get(int sector);       // Use the header at "sector"
+    void Release(Inode *inode);   // Done with it
+    void Forget(int sector);      // The header at "sector" is gone
+
+   private:
+    Inode *buckets[InodeBuckets];  // Hash chains, by sector
+    List<Inode *> *unused;         // Inodes nobody uses, least
+                                   // recently released first
+
+    Inode *Find(int sector);       // Find an inode in the table
+    void Unhash(Inode *inode);     // Take it out of the table
+};
+
+#endif  // INODE_H
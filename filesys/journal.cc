@@ -0,0 +1,262 @@
+// journal.cc
+//	Routines to lay out and replay the metadata journal.
+//
+//	Creating a file used to write its header, a directory bucket and
+//	directory header, and a sector of the free map, each to its own
+//	place on disk, before returning.  Now the sectors an operation
+//	changes stay in the cache, and those of several operations are
+//	committed together as one group: one request writes the group to
+//	the log, a second the sector that commits it.  Only then may the
+//	flusher write the sectors back to their homes, whenever it gets
+//	around to it.
+//
+//	The log fills up from the front.  When it is nearly full, every
+//	committed sector is written back, and the log starts over.  The
+//	header sector says which group is then the first; groups have
+//	increasing sequence numbers, so recovery stops at the first sector
+//	that is not the next group, or at a group that was never committed.
+//
+//	The allocation of the journal itself is done by the file system;
+//	this module only knows where it is.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "journal.h"
+
+#include "copyright.h"
+#include "debug.h"
+#include "main.h"
+
+// What kind of sector a JournalBlock is.
+static const int HeaderMagic = 0x4a726e6c;
+static const int ChunkMagic = 0x4a43686b;
+static const int CommitMagic = 0x4a436d74;
+
+//----------------------------------------------------------------------
+// Journal::Journal
+// 	Initialize the in-core state of the journal.  Nothing is known
+//	about the log on disk until Format or Recover is called.
+//
+//	"start" -- the first sector of the journal, its header
+//	"size" -- how many sectors it has; there must be room for the
+//		longest group
+//----------------------------------------------------------------------
+
+Journal::Journal(int start, int size) {
+    ASSERT(size >= JournalMinSize);
+    this->start = start;
+    this->size = size;
+    head = start + 1;
+    seq = 1;
+    numActive = 0;
+    inLog = new Bitmap(NumSectors);
+}
+
+//----------------------------------------------------------------------
+// Journal::~Journal
+// 	De-allocate the journal.
+//----------------------------------------------------------------------
+
+Journal::~Journal() {
+    delete inLog;
+}
+
+//----------------------------------------------------------------------
+// Journal::Format
+// 	Write the header of an empty log, whose first group is the next
+//	one we will commit.
+//
+//	If the disk had a log here before (it is being formatted again),
+//	committed groups of it may still be there.  Groups are numbered
+//	past any of them, so that none can be taken for one of ours.
+//----------------------------------------------------------------------
+
+void Journal::Format() {
+    char header[SectorSize];
+    JournalBlock old;
+
+    kernel->synchDisk->ReadSector(start, (char *)&old);
+    if (old.magic == HeaderMagic)
+        seq = max(seq, old.seq + size);  // a group takes a sector at least
+    kernel->synchDisk->WriteSector(Restart(header), header);
+}
+
+//----------------------------------------------------------------------
+// Journal::Recover
+// 	Write every group committed since the log last started over back
+//	to where its sectors belong, oldest first, and start an empty
+//	log.  Called when the file system is mounted, before anything
+//	else is read.
+//
+//	A group that was being written when we crashed is on disk without
+//	its commit sector, and is ignored.  Its sequence number is used
+//	again for the next group; only that group's commit sector can
+//	ever carry it.
+//----------------------------------------------------------------------
+
+void Journal::Recover() {
+    JournalBlock header;
+    int homes[JournalMax];
+    char *data = new char[JournalMax * SectorSize];
+    int pos = start + 1;
+    int count, numGroups = 0;
+
+    kernel->synchDisk->ReadSector(start, (char *)&header);
+    if (header.magic == HeaderMagic) {
+        seq = header.seq;
+        while (ReadGroup(pos, homes, data, &count)) {
+            DEBUG(dbgFile, "Replaying group " << seq << ", " << count << " sectors");
+            for (int i = 0; i < count; i++)
+                kernel->synchDisk->WriteSector(homes[i], &data[i * SectorSize]);
+            pos += Length(count);
+            seq++;
+            numGroups++;
+        }
+    }
+    DEBUG(dbgFile, "Replayed " << numGroups << " groups from the journal");
+    if (numGroups > 0 || header.magic != HeaderMagic) {
+        Format();
+        kernel->synchDisk->Flush();
+    }
+    delete[] data;
+}
+
+//----------------------------------------------------------------------
+// Journal::Begin/End
+// 	Bracket the changes an operation makes to the file system.  When
+//	the last operation in progress ends, the changes are committed if
+//	enough of them have piled up.  Operations may nest.
+//----------------------------------------------------------------------
+
+void Journal::Begin() {
+    numActive++;
+}
+
+void Journal::End() {
+    ASSERT(numActive > 0);
+    if (--numActive == 0)
+        kernel->synchDisk->Commit(FALSE);
+}
+
+//----------------------------------------------------------------------
+// Journal::Length
+// 	Return how many sectors of the log a group of "count" sectors
+//	takes: a descriptor for each JournalPerBlock of them, and the
+//	commit sector.
+//----------------------------------------------------------------------
+
+int Journal::Length(int count) {
+    return count + divRoundUp(count, JournalPerBlock) + 1;
+}
+
+//----------------------------------------------------------------------
+// Journal::Fits
+// 	Return TRUE if a group "length" sectors long fits in what is left
+//	of the log.
+//----------------------------------------------------------------------
+
+bool Journal::Fits(int length) {
+    return head + length <= start + size;
+}
+
+//----------------------------------------------------------------------
+// Journal::Pack
+// 	Lay out the next group in "group", which must hold Length(count)
+//	sectors, and return the log sector it is to be written at.  The
+//	caller writes all but the last sector, then the last one, which
+//	commits it.  From now on, the sectors in it are logged.
+//
+//	"homes" -- where each sector belongs
+//	"data" -- the contents of the sectors, one after the other
+//	"count" -- how many sectors there are
+//----------------------------------------------------------------------
+
+int Journal::Pack(char *group, int *homes, char *data, int count) {
+    int length = Length(count);
+    int where = head;
+    JournalBlock *block;
+    int pos = 0;
+
+    ASSERT(count > 0 && count <= JournalMax && Fits(length));
+    memset(group, 0, length * SectorSize);
+    for (int i = 0; i < count; i += JournalPerBlock) {
+        block = (JournalBlock *)&group[pos * SectorSize];
+        block->magic = ChunkMagic;
+        block->seq = seq;
+        block->count = min(JournalPerBlock, count - i);
+        for (int j = 0; j < block->count; j++) {
+            block->homes[j] = homes[i + j];
+            inLog->Mark(homes[i + j]);
+        }
+        bcopy(&data[i * SectorSize], &group[(pos + 1) * SectorSize], block->count * SectorSize);
+        pos += 1 + block->count;
+    }
+    block = (JournalBlock *)&group[pos * SectorSize];
+    block->magic = CommitMagic;
+    block->seq = seq;
+    block->count = count;
+
+    DEBUG(dbgFile, "Group " << seq << ": " << count << " sectors at log sector " << where);
+    head += length;
+    seq++;
+    return where;
+}
+
+//----------------------------------------------------------------------
+// Journal::Restart
+// 	Empty the log: the next group goes at the front.  Fill in
+//	"header" with the new contents of the journal header, which the
+//	caller must write once every sector logged so far is back home,
+//	to the sector we return.
+//----------------------------------------------------------------------
+
+int Journal::Restart(char *header) {
+    JournalBlock *block = (JournalBlock *)header;
+
+    memset(header, 0, SectorSize);
+    block->magic = HeaderMagic;
+    block->seq = seq;
+    head = start + 1;
+    delete inLog;
+    inLog = new Bitmap(NumSectors);
+    return start;
+}
+
+//----------------------------------------------------------------------
+// Journal::ReadGroup
+// 	Read the group at log sector "pos", which should be the one
+//	numbered "seq".  Return FALSE if it is not there, or was not
+//	committed; otherwise put where its sectors belong in "homes",
+//	their contents in "data", and how many there are in "count".
+//----------------------------------------------------------------------
+
+bool Journal::ReadGroup(int pos, int *homes, char *data, int *count) {
+    JournalBlock block;
+    int end = start + size;
+    int n = 0;
+
+    while (pos < end) {
+        kernel->synchDisk->ReadSector(pos, (char *)&block);
+        if (block.seq != seq)
+            return FALSE;
+        if (block.magic == CommitMagic) {
+            *count = n;
+            return n > 0 && block.count == n;
+        }
+        if (block.magic != ChunkMagic || block.count <= 0 || block.count > JournalPerBlock ||
+            n + block.count > JournalMax || pos + 1 + block.count >= end)
+            return FALSE;
+        for (int i = 0; i < block.count; i++) {
+            if (block.homes[i] < 0 || block.homes[i] >= NumSectors ||
+                (block.homes[i] >= start && block.homes[i] < end))
+                return FALSE;
+            homes[n + i] = block.homes[i];
+        }
+        kernel->synchDisk->ReadSectors(pos + 1, &data[n * SectorSize], block.count);
+        n += block.count;
+        pos += 1 + block.count;
+    }
+    return FALSE;
+}
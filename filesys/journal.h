@@ -0,0 +1,114 @@
+// journal.h
+//	Data structures for the metadata journal: a circular log on disk,
+//	where the sectors that file system operations change are written
+//	(all together, in one sequential request) before they may be
+//	written back to where they belong.
+//
+//	We assume mutual exclusion is provided by the caller.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "bitmap.h"
+#include "disk.h"
+#include "synchdisk.h"
+
+// When the changed sectors are committed.  Once an operation ends
+// with JournalBatch of them waiting, they are committed at once;
+// otherwise the flusher commits them when they have waited for
+// CommitExpire ticks.  An operation may not keep more than JournalMax
+// waiting, since they cannot leave the cache; if one changes more,
+// it is committed in pieces.
+const int JournalMax = CacheSize / 4;         // sectors
+const int JournalBatch = JournalMax / 2;      // sectors
+const int CommitExpire = DirtyExpire / 4;     // ticks
+
+// Home sectors listed in each descriptor sector of a group.
+const int JournalPerBlock = SectorSize / sizeof(int) - 3;
+
+// The smallest journal: its header, and room for the biggest group
+// (see Journal::Length).
+const int JournalMinSize = 1 + JournalMax + divRoundUp(JournalMax, JournalPerBlock) + 1;
+
+// The following class defines the sector at the front of each chunk
+// of a group: the group's sequence number, and where the "count"
+// sectors that follow it belong.  A group is one or more chunks,
+// followed by a sector of the same kind with "count" set to the
+// number of sectors in the whole group; only once that commit sector
+// is on disk does the group count.
+//
+// The journal header has the same layout; its "seq" is the first
+// group to replay.
+
+class JournalBlock {
+   public:
+    int magic;                     // Which kind of sector this is
+    int seq;                       // Group sequence number
+    int count;                     // Sectors in the chunk (or group)
+    int homes[JournalPerBlock];    // Where they belong
+};
+
+// The following class defines the journal.  File system operations
+// bracket the changes they make with Begin and End; SynchDisk keeps
+// every sector written meanwhile in its cache until it is committed,
+// using Length, Fits and Pack to lay out the group, and Restart once
+// everything committed so far has been written back.  A sector that
+// has been committed stays "logged" until then, and later writes to
+// it are logged too, so that replaying an old copy of it can never
+// overwrite newer contents.
+//
+// Recover replays the committed groups, in order, when the file
+// system is mounted.
+//
+// Where the journal is, and how long, is up to the file system (cf.
+// superblock.h).  Its first sector says with which group the log
+// starts; the groups themselves follow it, one after the other.
+
+class Journal {
+   public:
+    Journal(int start, int size);  // Initialize the journal, "size"
+                                   // sectors from "start", before it
+                                   // is formatted or recovered
+    ~Journal();  // De-allocate it
+
+    void Format();   // Start an empty log on a new disk
+    void Recover();  // Replay the groups committed before a crash,
+                     // and start an empty log
+
+    void Begin();  // An operation starts changing metadata
+    void End();    // It is done
+    bool Active() { return numActive > 0; }
+    bool Empty() { return head == start + 1; }
+    bool Logged(int sector) { return inLog->Test(sector); }
+    // Has "sector" been committed since the log was last emptied?
+
+    int Length(int count);   // Sectors in a group of "count" sectors
+    bool Fits(int length);   // Is there room for a group that long?
+    int Pack(char *group, int *homes, char *data, int count);
+    // Lay out a group of "count" sectors
+    // in "group", and return where in
+    // the log it goes
+    int Restart(char *header);  // Empty the log, now that everything
+                                // in it has been written back;
+                                // return where "header" goes
+
+   private:
+    int start;        // The journal header
+    int size;         // Sectors in the journal, header included
+    int head;         // Where the next group goes
+    int seq;          // Sequence number of the next group
+    int numActive;    // Operations in progress
+    Bitmap *inLog;    // Home sectors of the groups in the log
+
+    bool ReadGroup(int pos, int *homes, char *data, int *count);
+    // Read the group at "pos", if it
+    // was committed
+};
+
+#endif  // JOURNAL_H
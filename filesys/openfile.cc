@@ -5,7 +5,15 @@
 //	the OpenFile data structure).
 //
 //	Also as in UNIX, for convenience, we keep the file header in
-//	memory while the file is open.
+//	memory while the file is open.  It comes from the inode table
+//	(cf. inode.h), so all the OpenFiles on a file share one copy.
+//
+//	When a file is read sequentially, the sectors that come next
+//	are read into the disk cache ahead of time.
+//
+//	Each OpenFile looks up where the sectors are through its own
+//	MapCursor, which remembers the part of the file's map it last
+//	used.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -16,21 +24,30 @@
 
 #include "copyright.h"
 #include "filehdr.h"
+#include "inode.h"
 #include "main.h"
+#include "pool.h"
 #include "synchdisk.h"
 
+static Pool openFilePool("open files", sizeof(OpenFile), 16);
+
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
 // 	Open a Nachos file for reading and writing.  Bring the file header
-//	into memory while the file is open.
+//	into memory while the file is open, unless it is there already.
 //
 //	"sector" -- the location on disk of the file header for this file
 //----------------------------------------------------------------------
 
 OpenFile::OpenFile(int sector) {
-    hdr = new FileHeader;
-    hdr->FetchFrom(sector);
+    inode = kernel->inodeTable->Get(sector);
+    hdr = inode->hdr;
+    hdrSector = sector;
     seekPosition = 0;
+    cursor = new MapCursor(hdr, kernel->flatMapMax);
+    nextReadPosition = 0;  // reading from the start counts as sequential
+    readAheadWindow = 0;
+    readAheadEnd = 0;
 }
 
 //----------------------------------------------------------------------
@@ -39,7 +56,23 @@ OpenFile::OpenFile(int sector) {
 //----------------------------------------------------------------------
 
 OpenFile::~OpenFile() {
-    delete hdr;
+    delete cursor;
+    kernel->inodeTable->Release(inode);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::operator new
+// OpenFile::operator delete
+// 	Get an open file from the pool of them, and put it back.
+//----------------------------------------------------------------------
+
+void *OpenFile::operator new(size_t size) {
+    ASSERT(size == sizeof(OpenFile));
+    return openFilePool.Get();
+}
+
+void OpenFile::operator delete(void *object) {
+    openFilePool.Put(object);
 }
 
 //----------------------------------------------------------------------
@@ -90,13 +123,30 @@ int OpenFile::Write(char *into, int numBytes) {
 //	sector at a time.  Thus:
 //
 //	For ReadAt:
-//	   We read in all of the full or partial sectors that are part of the
-//	   request, but we only copy the part we are interested in.
+//	   The sectors wholly inside the request are read straight into
+//	   the caller's buffer.  A sector only partly inside it, at either
+//	   end, is read into a sector buffer on the stack, and we only copy
+//	   the part we are interested in.
+//	   Sectors that are next to each other on disk are read together,
+//	   and holes in the file are not read at all, just zeroed.
+//	   The data of a tiny file is in its header, already in memory.
 //	For WriteAt:
 //	   We must first read in any sectors that will be partially written,
-//	   so that we don't overwrite the unmodified portion.  We then copy
-//	   in the data that will be modified, and write back all the full
-//	   or partial sectors that are part of the request.
+//	   so that we don't overwrite the unmodified portion, and copy into
+//	   them the data that will be modified.  If the request goes past the
+//	   end of the file, or covers holes, sectors are allocated for it
+//	   (a gap between the old end of the file and "position" is left a
+//	   hole); if the disk is full, we write only what fits in the file
+//	   as it is.  Finally we write back the partial sectors, and the
+//	   full ones straight from the caller's buffer.
+//	   A write that leaves a tiny file small enough to stay in its
+//	   header just changes the header, and writes it back.
+//
+//	So a request that starts and ends on sector boundaries needs no
+//	memory beyond the caller's.  The only copies are to and from the
+//	disk cache: sectors read from the disk go straight into "into",
+//	and are copied from there into the cache, and "from" is copied
+//	into the cache, to be written back later.
 //
 //	"into" -- the buffer to contain the data to be read from disk
 //	"from" -- the buffer containing the data to be written to disk
@@ -107,8 +157,8 @@ int OpenFile::Write(char *into, int numBytes) {
 
 int OpenFile::ReadAt(char *into, int numBytes, int position) {
     int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    char *buf;
+    int firstSector, lastSector, firstFull, lastFull, offset;
+    char edge[SectorSize];
 
     if ((numBytes <= 0) || (position >= fileLength))
         return 0;  // check request
@@ -116,61 +166,182 @@ int OpenFile::ReadAt(char *into, int numBytes, int position) {
         numBytes = fileLength - position;
     DEBUG(dbgFile, "Reading " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    if (hdr->IsInline()) {
+        hdr->ReadInline(into, numBytes, position);
+        return numBytes;
+    }
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
+    firstFull = divRoundUp(position, SectorSize);
+    lastFull = divRoundDown(position + numBytes, SectorSize) - 1;
 
-    // read in all the full and partial sectors that we need
-    buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
-                                      &buf[(i - firstSector) * SectorSize]);
+    // the full sectors go in place, and the partial sectors at either
+    // end, if any, through the edge buffer
+    if (firstSector < firstFull) {
+        offset = position - firstSector * SectorSize;
+        ReadSectors(firstSector, 1, edge);
+        bcopy(&edge[offset], into, min(numBytes, SectorSize - offset));
+    }
+    if (firstFull <= lastFull)
+        ReadSectors(firstFull, lastFull - firstFull + 1, &into[firstFull * SectorSize - position]);
+    if (lastSector > lastFull && lastSector >= firstFull) {
+        offset = lastSector * SectorSize - position;
+        ReadSectors(lastSector, 1, edge);
+        bcopy(edge, &into[offset], numBytes - offset);
+    }
 
-    // copy the part we want
-    bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
-    delete[] buf;
+    if (position == nextReadPosition) {
+        ReadAhead(lastSector);
+    } else {
+        readAheadWindow = 0;  // random access; start over
+        readAheadEnd = 0;
+    }
+    nextReadPosition = position + numBytes;
     return numBytes;
 }
 
 int OpenFile::WriteAt(char *from, int numBytes, int position) {
     int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    bool firstAligned, lastAligned;
-    char *buf;
+    int i, firstSector, lastSector, firstFull, lastFull, run, offset;
+    bool firstPartial, lastPartial, holes;
+    char firstEdge[SectorSize], lastEdge[SectorSize];
 
-    if ((numBytes <= 0) || (position >= fileLength))
+    if ((numBytes <= 0) || (position < 0))
         return 0;  // check request
-    if ((position + numBytes) > fileLength)
-        numBytes = fileLength - position;
+    if (hdr->IsInline() && (position + numBytes) <= MaxInlineBytes) {
+        hdr->WriteInline(from, numBytes, position);
+        hdr->WriteBack(hdrSector);
+        return numBytes;
+    }
     DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
+    firstFull = divRoundUp(position, SectorSize);
+    lastFull = divRoundDown(position + numBytes, SectorSize) - 1;
+    firstPartial = (firstSector < firstFull);
+    lastPartial = (lastSector > lastFull && lastSector >= firstFull);
 
-    buf = new char[numSectors * SectorSize];
+    // read in first and last sector, if they are to be partially
+    // modified, before any sectors are allocated for them; what is
+    // past the end of the file reads as zeros
+    if (firstPartial) {
+        offset = position - firstSector * SectorSize;
+        ReadEdge(firstSector, firstEdge);
+        bcopy(from, &firstEdge[offset], min(numBytes, SectorSize - offset));
+    }
+    if (lastPartial) {
+        offset = lastSector * SectorSize - position;
+        ReadEdge(lastSector, lastEdge);
+        bcopy(&from[offset], lastEdge, numBytes - offset);
+    }
 
-    memset(buf, 0, sizeof(char) * numSectors * SectorSize);  // dummy operation to keep valgrind happy
+    // make sure every sector we write has a place on disk
+    holes = ((position + numBytes) > fileLength);
+    for (i = firstSector; !holes && i <= lastSector; i += run)
+        holes = (cursor->ByteToRun(i * SectorSize, lastSector - i + 1, &run) == HoleSector);
+    if (holes && !kernel->fileSystem->Fill(this, position, position + numBytes)) {
+        if (position < fileLength && (position + numBytes) > fileLength)
+            return WriteAt(from, fileLength - position, position);  // disk full
+        return 0;
+    }
 
-    firstAligned = (position == (firstSector * SectorSize));
-    lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
+    // write modified sectors back
+    if (firstPartial)
+        WriteSectors(firstSector, 1, firstEdge);
+    if (firstFull <= lastFull)
+        WriteSectors(firstFull, lastFull - firstFull + 1, &from[firstFull * SectorSize - position]);
+    if (lastPartial)
+        WriteSectors(lastSector, 1, lastEdge);
+    return numBytes;
+}
 
-    // read in first and last sector, if they are to be partially modified
-    if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize],
-               SectorSize, lastSector * SectorSize);
+//----------------------------------------------------------------------
+// OpenFile::ReadSectors
+// 	Read "count" sectors of the file, starting with file sector
+//	"first", into "into", a run of them at a time.  Holes read as
+//	zeros.
+//----------------------------------------------------------------------
 
-    // copy in the bytes we want to change
-    bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
+void OpenFile::ReadSectors(int first, int count, char *into) {
+    int sector, run;
 
-    // write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize),
-                                       &buf[(i - firstSector) * SectorSize]);
-    delete[] buf;
-    return numBytes;
+    for (int i = 0; i < count; i += run) {
+        sector = cursor->ByteToRun((first + i) * SectorSize, count - i, &run);
+        if (sector == HoleSector)
+            memset(&into[i * SectorSize], 0, run * SectorSize);
+        else
+            kernel->synchDisk->ReadSectors(sector, &into[i * SectorSize], run);
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadEdge
+// 	Read file sector "sector", which WriteAt is about to change in
+//	part, into "into".  What is past the end of the file reads as
+//	zeros.  Unlike ReadAt, this does not count as a read, so it
+//	leaves read-ahead alone.
+//----------------------------------------------------------------------
+
+void OpenFile::ReadEdge(int sector, char *into) {
+    int start = sector * SectorSize;
+    int length = min(SectorSize, hdr->FileLength() - start);
+
+    memset(into, 0, SectorSize);
+    if (length <= 0)
+        return;
+    if (hdr->IsInline()) {
+        hdr->ReadInline(into, length, start);
+    } else {
+        ReadSectors(sector, 1, into);
+        memset(&into[length], 0, SectorSize - length);
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenFile::WriteSectors
+// 	Write "count" sectors of the file, starting with file sector
+//	"first", from "from", a run of them at a time.  The sectors must
+//	all have a place on disk already.
+//----------------------------------------------------------------------
+
+void OpenFile::WriteSectors(int first, int count, char *from) {
+    int sector, run;
+
+    for (int i = 0; i < count; i += run) {
+        sector = cursor->ByteToRun((first + i) * SectorSize, count - i, &run);
+        ASSERT(sector != HoleSector);
+        kernel->synchDisk->WriteSectors(sector, &from[i * SectorSize], run);
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+// 	Called after a sequential read ending in file sector "lastSector".
+//	When less than half a window of read-ahead sectors is left in
+//	front of the reader, prefetch the next window, doubling it each
+//	time up to kernel->readAheadMax.  Only the run of sectors that
+//	are next to each other on disk is prefetched, since that is one
+//	disk request.
+//----------------------------------------------------------------------
+
+void OpenFile::ReadAhead(int lastSector) {
+    int fileSectors = divRoundUp(hdr->FileLength(), SectorSize);
+    int first, sector, run;
+
+    if (kernel->readAheadMax == 0 || readAheadEnd - lastSector > readAheadWindow / 2)
+        return;
+    readAheadWindow = (readAheadWindow == 0) ? 4 : 2 * readAheadWindow;
+    readAheadWindow = min(readAheadWindow, kernel->readAheadMax);
+
+    first = max(lastSector + 1, readAheadEnd);
+    if (first >= fileSectors)
+        return;
+    sector = cursor->ByteToRun(first * SectorSize, min(readAheadWindow, fileSectors - first), &run);
+    if (sector != HoleSector)  // nothing to read in a hole
+        kernel->synchDisk->Prefetch(sector, run);
+    readAheadEnd = first + run;
 }
 
 //----------------------------------------------------------------------
@@ -182,4 +353,25 @@ int OpenFile::Length() {
     return hdr->FileLength();
 }
 
+//----------------------------------------------------------------------
+// OpenFile::Fill
+// 	Allocate sectors for the holes between bytes "from" and "to" of
+//	the file, making it "to" bytes long if it is shorter, and write
+//	the changed header back to disk.  Return FALSE, leaving the file
+//	as it was, if there is no room; the caller must revert "freeMap"
+//	then, and otherwise write it back.
+//
+//	"freeMap" -- the bit map of free disk sectors
+//	"from", "to" -- the byte range, which the caller will write
+//----------------------------------------------------------------------
+
+bool OpenFile::Fill(PersistentBitmap *freeMap, int from, int to) {
+    if (from >= to)
+        return TRUE;
+    if (!hdr->Fill(freeMap, from, to))
+        return FALSE;
+    hdr->WriteBack(hdrSector);
+    return TRUE;
+}
+
 #endif  // FILESYS_STUB
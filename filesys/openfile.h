@@ -67,6 +67,9 @@ class OpenFile {
 
 #else  // FILESYS
 class FileHeader;
+class Inode;
+class MapCursor;
+class PersistentBitmap;
 
 class OpenFile {
    public:
@@ -74,6 +77,9 @@ class OpenFile {
                            // at "sector" on the disk
     ~OpenFile();           // Close the file
 
+    static void *operator new(size_t size);  // From a pool of them
+    static void operator delete(void *object);
+
     void Seek(int position);  // Set the position from which to
                               // start reading/writing -- UNIX lseek
 
@@ -93,9 +99,33 @@ class OpenFile {
                    // than the UNIX idiom -- lseek to
                    // end of file, tell, lseek back
 
+    bool Fill(PersistentBitmap *freeMap, int from, int to);
+    // Allocate sectors for a byte range,
+    // lengthening the file if need be,
+    // and write its header back to disk
+
    private:
-    FileHeader *hdr;   // Header for this file
+    Inode *inode;      // In-core inode for this file
+    FileHeader *hdr;   // Its header, shared with other
+                       // OpenFiles on the same file
+    int hdrSector;     // Where the header is on disk
     int seekPosition;  // Current position within the file
+    MapCursor *cursor; // Finds the sectors of the file for us
+
+    int nextReadPosition;  // Where a sequential ReadAt would start
+    int readAheadWindow;   // Sectors to read ahead, grows while the
+                           // file is read sequentially
+    int readAheadEnd;      // File sector just past the last one
+                           // read ahead
+
+    void ReadAhead(int lastSector);  // Prefetch past "lastSector"
+    void ReadSectors(int first, int count, char *into);
+    // Read whole sectors of the file
+    void WriteSectors(int first, int count, char *from);
+    // Write them back
+    void ReadEdge(int sector, char *into);
+    // Read a sector a write changes
+    // in part
 };
 
 #endif  // FILESYS
@@ -2,6 +2,16 @@
 //	Routines to manage a persistent bitmap -- a bitmap that is
 //	stored on disk.
 //
+//	The bitmap storage is divided into chunks of one disk sector
+//	each.  Mark and Clear remember which chunks they touched, so that
+//	WriteBack only writes those chunks, and Revert only re-reads them.
+//
+//	File data may be allocated in blocks of several sectors (cf.
+//	superblock.h).  Each bit still stands for a sector, since file
+//	headers and index blocks take one sector each, but Mark and Clear
+//	also keep count of the blocks that are entirely free, so that
+//	whether a file fits can be told without searching.
+//
 // Copyright (c) 1992,1993,1995 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
@@ -9,6 +19,8 @@
 #include "pbitmap.h"
 
 #include "copyright.h"
+#include "debug.h"
+#include "disk.h"
 
 //----------------------------------------------------------------------
 // PersistentBitmap::PersistentBitmap(int)
@@ -17,10 +29,14 @@
 //
 //	"numItems" is the number of bits in the bitmap.
 //
-//      This constructor does not initialize the bitmap from a disk file
+//      This constructor does not initialize the bitmap from a disk file,
+//	so every chunk starts out dirty.
 //----------------------------------------------------------------------
 
 PersistentBitmap::PersistentBitmap(int numItems) : Bitmap(numItems) {
+    InitChunks(TRUE);
+    blockBits = 1;
+    numFreeBlocks = numItems;
 }
 
 //----------------------------------------------------------------------
@@ -39,7 +55,11 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
     // map has already been initialized by the BitMap constructor,
     // but we will just overwrite that with the contents of the
     // map found in the file
+    InitChunks(FALSE);
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    Recount();
+    blockBits = 1;
+    numFreeBlocks = numClear;
 }
 
 //----------------------------------------------------------------------
@@ -48,6 +68,32 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
 //----------------------------------------------------------------------
 
 PersistentBitmap::~PersistentBitmap() {
+    delete[] dirty;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Mark/Clear
+// 	Set or clear the "nth" bit, and note that the chunk containing
+//	it will have to be written back.  Setting a bit of a free block
+//	makes it not free; clearing the last set bit of one frees it.
+//
+//	"which" is the number of the bit to be set or cleared.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::Mark(int which) {
+    if (blockBits > 1 && !Test(which) && BlockFree(which / blockBits))
+        numFreeBlocks--;
+    Bitmap::Mark(which);
+    dirty[which / (SectorSize * BitsInByte)] = TRUE;
+}
+
+void PersistentBitmap::Clear(int which) {
+    bool wasSet = Test(which);
+
+    Bitmap::Clear(which);
+    dirty[which / (SectorSize * BitsInByte)] = TRUE;
+    if (blockBits > 1 && wasSet && BlockFree(which / blockBits))
+        numFreeBlocks++;
 }
 
 //----------------------------------------------------------------------
@@ -59,15 +105,138 @@ PersistentBitmap::~PersistentBitmap() {
 
 void PersistentBitmap::FetchFrom(OpenFile *file) {
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    for (int i = 0; i < numChunks; i++)
+        dirty[i] = FALSE;
+    Recount();
+    CountFreeBlocks();
 }
 
 //----------------------------------------------------------------------
 // PersistentBitmap::WriteBack
-// 	Store the contents of a persistent bitmap to a Nachos file.
+// 	Store the changed parts of a persistent bitmap to a Nachos file.
 //
 //	"file" is the place to write the bitmap to
 //----------------------------------------------------------------------
 
 void PersistentBitmap::WriteBack(OpenFile *file) {
-    file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+    for (int i = 0; i < numChunks; i++) {
+        if (dirty[i]) {
+            file->WriteAt((char *)map + i * SectorSize, ChunkBytes(i),
+                          i * SectorSize);
+            dirty[i] = FALSE;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Revert
+// 	Throw away every change made since the last FetchFrom/WriteBack,
+//	by re-reading the chunks that were changed.  Used when an
+//	operation fails half-way through.
+//
+//	"file" is the place to read the bitmap from
+//----------------------------------------------------------------------
+
+void PersistentBitmap::Revert(OpenFile *file) {
+    for (int i = 0; i < numChunks; i++) {
+        if (dirty[i]) {
+            file->ReadAt((char *)map + i * SectorSize, ChunkBytes(i),
+                         i * SectorSize);
+            dirty[i] = FALSE;
+        }
+    }
+    Recount();
+    CountFreeBlocks();
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::SetBlockSize
+// 	Start counting free blocks of "bits" bits, the first one at bit
+//	0.  "bits" must be a power of two that divides the size of the
+//	map.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::SetBlockSize(int bits) {
+    ASSERT(bits > 0 && (bits & (bits - 1)) == 0 && numBits % bits == 0);
+    blockBits = bits;
+    CountFreeBlocks();
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindAndSetBlockNear
+// 	Like FindAndSetNear, but for a whole free block: set all its bits,
+//	and return the first.  The search starts with the first block
+//	that begins at or after "goal".  Return -1 if there are no free
+//	blocks.
+//
+//	"goal" is where the search starts
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindAndSetBlockNear(int goal) {
+    int numBlocks = numBits / blockBits;
+    int block = divRoundUp(goal, blockBits) % numBlocks;
+
+    if (blockBits == 1)
+        return FindAndSetNear(goal);
+    if (numFreeBlocks == 0)
+        return -1;
+    while (!BlockFree(block))
+        block = (block + 1) % numBlocks;  // there is one, somewhere
+    for (int i = 0; i < blockBits; i++)
+        Mark(block * blockBits + i);
+    return block * blockBits;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::InitChunks
+// 	Allocate one dirty flag per sector-sized chunk of the map.
+//
+//	"isDirty" is the initial value of every flag
+//----------------------------------------------------------------------
+
+void PersistentBitmap::InitChunks(bool isDirty) {
+    numChunks = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+    dirty = new bool[numChunks];
+    for (int i = 0; i < numChunks; i++)
+        dirty[i] = isDirty;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::ChunkBytes
+// 	Return the number of bytes of storage in "chunk"; the last chunk
+//	may be short.
+//----------------------------------------------------------------------
+
+int PersistentBitmap::ChunkBytes(int chunk) {
+    int totalBytes = numWords * sizeof(unsigned);
+
+    return min(SectorSize, totalBytes - chunk * SectorSize);
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::BlockFree
+// 	Return TRUE if every bit of block "block" is clear.  A block is
+//	either part of one word of the map, or a number of whole words.
+//----------------------------------------------------------------------
+
+bool PersistentBitmap::BlockFree(int block) {
+    int first = block * blockBits;
+
+    if (blockBits >= BitsInWord)
+        return NumClear(first, first + blockBits) == blockBits;
+    return ((map[first / BitsInWord] >> (first % BitsInWord)) & ((1u << blockBits) - 1)) == 0;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::CountFreeBlocks
+// 	Count the free blocks again, after the map has been read in.
+//----------------------------------------------------------------------
+
+void PersistentBitmap::CountFreeBlocks() {
+    numFreeBlocks = 0;
+    if (blockBits == 1)
+        return;  // NumClear counts them
+    for (int block = 0; block < numBits / blockBits; block++)
+        if (BlockFree(block))
+            numFreeBlocks++;
 }
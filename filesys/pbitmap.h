@@ -20,6 +20,15 @@
 // The following class defines a persistent bitmap.  It inherits all
 // the behavior of a bitmap (see bitmap.h), adding the ability to
 // be read from and stored to the disk.
+//
+// The bitmap remembers which sector-sized chunks of its storage have
+// changed since they were last read or written, so that WriteBack
+// only has to write those chunks.
+//
+// It also keeps count of its free blocks: aligned groups of
+// "blockBits" bits that are all clear, from which data is allocated
+// a block at a time (cf. FileHeader::SetBlockSize).  With one bit
+// per block, every clear bit is a free block.
 
 class PersistentBitmap : public Bitmap {
    public:
@@ -28,8 +37,31 @@ class PersistentBitmap : public Bitmap {
 
     ~PersistentBitmap();  // deallocate bitmap
 
+    void Mark(int which);   // Set/clear the "nth" bit, and
+    void Clear(int which);  //   remember its chunk is dirty
+
     void FetchFrom(OpenFile *file);  // read bitmap from the disk
-    void WriteBack(OpenFile *file);  // write bitmap contents to disk
+    void WriteBack(OpenFile *file);  // write changed chunks to disk
+    void Revert(OpenFile *file);     // re-read changed chunks, undoing
+                                     // everything since the last WriteBack
+
+    void SetBlockSize(int bits);  // Allocate blocks of "bits" bits
+    int NumFreeBlocks() { return (blockBits == 1) ? NumClear() : numFreeBlocks; }
+    int FindAndSetBlockNear(int goal);  // Set the bits of the first free
+                                        // block at or after "goal",
+                                        // wrapping around; return the
+                                        // first, or -1 if none is free
+
+   private:
+    int numChunks;  // number of SectorSize chunks of storage
+    bool *dirty;    // which chunks have changed?
+    int blockBits;      // bits in a block
+    int numFreeBlocks;  // blocks with all their bits clear
+
+    void InitChunks(bool isDirty);  // allocate the dirty flags
+    int ChunkBytes(int chunk);      // size of a chunk in bytes
+    bool BlockFree(int block);      // are all of its bits clear?
+    void CountFreeBlocks();         // recompute numFreeBlocks
 };
 
 #endif  // PBITMAP_H
@@ -0,0 +1,92 @@
+// superblock.cc
+//	Routines to read, write and print the superblock.
+//
+//	A disk is laid out, when it is formatted, according to the
+//	superblock; when it is mounted, the superblock is all that is
+//	read from a fixed place.  The fields that have to match how this
+//	build of Nachos was compiled are checked, so that a disk
+//	formatted by a different one is refused instead of misread.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "superblock.h"
+
+#include "copyright.h"
+#include "directory.h"
+#include "main.h"
+#include "synchdisk.h"
+
+// Says that a sector is a superblock.
+static const int SuperMagic = 0x53757062;
+
+//----------------------------------------------------------------------
+// Superblock::Superblock
+// 	Describe a new disk: the superblock comes first, then the
+//	headers of the bitmap and of the root directory, then the
+//	journal.  The caller may change the layout before formatting.
+//----------------------------------------------------------------------
+
+Superblock::Superblock() {
+    ASSERT(sizeof(Superblock) <= SectorSize);
+    magic = SuperMagic;
+    numSectors = NumSectors;
+    sectorSize = SectorSize;
+    nameMaxLen = FileNameMaxLen;
+    sectorsPerBlock = 1;
+    dirEntries = DefaultDirEntries;
+    freeMapSector = SuperblockSector + 1;
+    directorySector = SuperblockSector + 2;
+    journalSector = SuperblockSector + 3;
+    journalSize = DefaultJournalSize;
+    numFree = NumSectors;
+}
+
+//----------------------------------------------------------------------
+// Superblock::FetchFrom
+// 	Read the superblock from disk.  Return FALSE if "sector" does not
+//	hold one, or if the disk was formatted for a different geometry
+//	or directory entry than this build uses.
+//
+//	"sector" -- where the superblock is
+//----------------------------------------------------------------------
+
+bool Superblock::FetchFrom(int sector) {
+    char buffer[SectorSize];
+
+    kernel->synchDisk->ReadSector(sector, buffer);
+    bcopy(buffer, (char *)this, sizeof(Superblock));
+    return magic == SuperMagic && numSectors == NumSectors && sectorSize == SectorSize &&
+           nameMaxLen == FileNameMaxLen;
+}
+
+//----------------------------------------------------------------------
+// Superblock::WriteBack
+// 	Write the superblock back to disk.
+//
+//	"sector" -- where the superblock goes
+//----------------------------------------------------------------------
+
+void Superblock::WriteBack(int sector) {
+    char buffer[SectorSize];
+
+    memset(buffer, 0, SectorSize);
+    bcopy((char *)this, buffer, sizeof(Superblock));
+    kernel->synchDisk->WriteSector(sector, buffer);
+}
+
+//----------------------------------------------------------------------
+// Superblock::Print
+// 	Print how the disk is laid out, and how much of it is free.
+//----------------------------------------------------------------------
+
+void Superblock::Print() {
+    printf("Superblock: %d sectors of %d bytes, %d free (%d%%)\n", numSectors, sectorSize,
+           numFree, (int)((long long)numFree * 100 / numSectors));
+    printf("  allocation unit: %d sectors, names up to %d characters\n", sectorsPerBlock,
+           nameMaxLen);
+    printf("  new directories: room for %d entries\n", dirEntries);
+    printf("  free map header: %d, root directory header: %d\n", freeMapSector, directorySector);
+    printf("  journal: sectors %d to %d\n", journalSector, journalSector + journalSize - 1);
+}
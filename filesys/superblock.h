@@ -0,0 +1,59 @@
+// superblock.h
+//	Data structures for the superblock: the one sector of a Nachos
+//	disk whose place is fixed.  It says how the disk was laid out
+//	when it was formatted, and where everything else is, so that
+//	the layout can be chosen per disk rather than when Nachos is
+//	compiled.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef SUPERBLOCK_H
+#define SUPERBLOCK_H
+
+#include "disk.h"
+
+// Where the superblock is, so that it can be found on boot-up.
+const int SuperblockSector = 0;
+
+// The layout a disk is formatted with, unless told otherwise.
+const int DefaultDirEntries = 64;               // entries
+const int DefaultJournalSize = SectorsPerTrack;  // sectors
+
+// The following class defines the superblock.  Its fields are kept
+// on disk exactly as they are here; all but "numFree" are set when
+// the disk is formatted, and never change.
+//
+// "numFree" is written along with the free map, by every operation
+// that changes it, so that how full the disk is can be told without
+// counting.
+
+class Superblock {
+   public:
+    Superblock();  // Describe a disk with the default layout,
+                   // and nothing on it yet
+
+    bool FetchFrom(int sector);  // Read the superblock from disk;
+                                 // FALSE if it is not one this
+                                 // build of Nachos can mount
+    void WriteBack(int sector);  // Write it back to disk
+
+    void Print();  // Print the layout, and how full the disk is
+
+    int magic;            // Says that this is a superblock
+    int numSectors;       // Size of the disk formatted
+    int sectorSize;
+    int nameMaxLen;       // FileNameMaxLen it was formatted with
+    int sectorsPerBlock;  // Unit of allocation of data
+    int dirEntries;       // Entries a new directory has room for
+    int freeMapSector;    // Header of the bitmap of free sectors
+    int directorySector;  // Header of the root directory
+    int journalSector;    // First sector of the journal
+    int journalSize;      // Sectors in it, header included
+    int numFree;          // Free sectors
+};
+
+#endif  // SUPERBLOCK_H
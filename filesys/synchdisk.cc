@@ -5,10 +5,31 @@
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Recently used sectors are kept in a fixed-size buffer cache,
+//	found through a hash table on the sector number and replaced
+//	in LRU order.  Writes only update the cache; a dirty sector is
+//	written to disk when its slot is recycled, when the flusher
+//	thread gets to it, when Flush is called, or when the machine
+//	has nothing else to do (IdleFlush).
+//
+//	Runs of consecutive sectors -- missing from the cache on a read,
+//	or dirty when flushing -- are transferred with one disk request.
+//
+//	Because the physical disk can only handle one operation at a
+//	time, requests wait in a queue; the interrupt handler completes
+//	each one and sends the next to the disk, in the order given by
+//	the schedule.  A lock protects the cache, but it is released while
+//	a thread waits for its request, so that other threads can queue
+//	theirs.  The slots a request reads or writes are marked pending
+//	until it completes; a thread that needs a pending slot waits too.
+//	Nobody waits for a prefetch (read-ahead) or for the write-back of
+//	an evicted slot.
+//
+//	Sectors written while a file system operation is in progress are
+//	logged instead of dirty (cf. journal.cc): they may not be written
+//	back, nor their slots recycled, until CommitLogged has written
+//	them to the journal.  The lock is kept while committing, so that
+//	nobody changes the cache until the group is on disk.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -17,30 +38,150 @@
 #include "synchdisk.h"
 
 #include "copyright.h"
+#include "debug.h"
+#include "journal.h"
+#include "main.h"
+#include "pool.h"
+
+// Requests come and go with every cache miss and write-back, so they
+// are kept in a pool.
+static Pool requestPool("disk requests", sizeof(DiskRequest), 16);
+
+// Dummy function, because C++ does not allow a pointer to a member
+// function to be passed to Thread::Fork.
+static void FlusherThread(void *arg) { ((SynchDisk *)arg)->WriteBehind(); }
+
+// Ticks from "from" to "to".  totalTicks wraps around on a long run
+// (copying a few megabytes is enough), so times are only compared by
+// their difference.
+static int TicksBetween(int from, int to) { return (int)((unsigned)to - (unsigned)from); }
+
+//----------------------------------------------------------------------
+// DiskRequest::DiskRequest
+// 	Set up a request for "count" sectors starting at "sector".  The
+//	caller fills in the slots.
+//
+//	"data" -- where the data is to be transferred to or from, which
+//		must last until the request is done; if NULL, the request
+//		gets a buffer of its own
+//----------------------------------------------------------------------
+
+DiskRequest::DiskRequest(int sector, int count, bool writing, bool detached, char *data)
+    : sector(sector), count(count), writing(writing), detached(detached) {
+    done = FALSE;
+    ownBuf = (data == NULL);
+    buf = ownBuf ? new char[count * SectorSize] : data;
+    slots = NULL;
+}
+
+DiskRequest::~DiskRequest() {
+    if (ownBuf)
+        delete[] buf;
+}
+
+//----------------------------------------------------------------------
+// DiskRequest::operator new
+// DiskRequest::operator delete
+// 	Get a request from the pool of them, and put it back.
+//----------------------------------------------------------------------
+
+void *DiskRequest::operator new(size_t size) {
+    ASSERT(size == sizeof(DiskRequest));
+    return requestPool.Get();
+}
+
+void DiskRequest::operator delete(void *object) {
+    requestPool.Put(object);
+}
+
+//----------------------------------------------------------------------
+// DiskRequest::Overlaps
+// 	Return TRUE if the two requests have a sector in common.  The
+//	scheduler never lets such a request overtake an earlier one.
+//----------------------------------------------------------------------
+
+bool DiskRequest::Overlaps(DiskRequest *other) {
+    return sector < other->sector + other->count &&
+           other->sector < sector + count;
+}
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
 //	initializing the physical disk.
 //
+//	The buffer cache starts out empty; every slot is on the LRU list
+//	but on no hash chain.  The flusher thread is started here, and
+//	sleeps until there is something to write.
+//
+//	"schedule" -- "fcfs", "sstf" or "clook", the order in which
+//		queued requests are served; NULL means "clook"
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk() {
-    semaphore = new Semaphore("synch disk", 0);
+SynchDisk::SynchDisk(char *schedule) {
+    ioDone = new Semaphore("synch disk", 0);
     lock = new Lock("synch disk lock");
     disk = new Disk(this);
+    numWaiters = 0;
+
+    if (schedule == NULL || strcmp(schedule, "clook") == 0)
+        this->schedule = DiskCLOOK;
+    else if (strcmp(schedule, "sstf") == 0)
+        this->schedule = DiskSSTF;
+    else if (strcmp(schedule, "fcfs") == 0)
+        this->schedule = DiskFCFS;
+    else
+        ASSERTNOTREACHED();  // unknown schedule
+    queue = new List<DiskRequest *>;
+    active = NULL;
+    headSector = 0;
+    flushWanted = new Semaphore("flush wanted", 0);
+    flusherBusy = FALSE;
+    numDirty = 0;
+    oldestDirty = 0;
+    journal = NULL;
+    commitWanted = FALSE;
+    numLogged = 0;
+    oldestLogged = 0;
+
+    cache = new CacheEntry[CacheSize];
+    for (int i = 0; i < CacheSize; i++) {
+        cache[i].sector = -1;
+        cache[i].dirty = FALSE;
+        cache[i].dirtyTime = 0;
+        cache[i].pending = FALSE;
+        cache[i].prefetched = FALSE;
+        cache[i].logged = FALSE;
+        cache[i].hashNext = NULL;
+        cache[i].ioNext = NULL;
+        cache[i].lruPrev = (i == 0) ? NULL : &cache[i - 1];
+        cache[i].lruNext = (i == CacheSize - 1) ? NULL : &cache[i + 1];
+    }
+    for (int i = 0; i < CacheBuckets; i++)
+        buckets[i] = NULL;
+    lruHead = &cache[0];
+    lruTail = &cache[CacheSize - 1];
+
+    (new Thread("disk flusher", 1))->Fork(FlusherThread, (void *)this);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::~SynchDisk
 // 	De-allocate data structures needed for the synchronous disk
 //	abstraction.
+//
+//	By the time we get here the simulation is shutting down, so
+//	dirty sectors must already have been flushed (see IdleFlush).
 //----------------------------------------------------------------------
 
 SynchDisk::~SynchDisk() {
+    ASSERT(active == NULL);
     delete disk;
     delete lock;
-    delete semaphore;
+    delete ioDone;
+    delete flushWanted;
+    delete queue;
+    delete[] cache;
 }
 
 //----------------------------------------------------------------------
@@ -53,10 +194,7 @@ SynchDisk::~SynchDisk() {
 //----------------------------------------------------------------------
 
 void SynchDisk::ReadSector(int sectorNumber, char *data) {
-    lock->Acquire();  // only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P();  // wait for interrupt
-    lock->Release();
+    ReadSectors(sectorNumber, data, 1);
 }
 
 //----------------------------------------------------------------------
@@ -69,18 +207,768 @@ void SynchDisk::ReadSector(int sectorNumber, char *data) {
 //----------------------------------------------------------------------
 
 void SynchDisk::WriteSector(int sectorNumber, char *data) {
-    lock->Acquire();  // only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P();  // wait for interrupt
+    WriteSectors(sectorNumber, data, 1);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectors
+// 	Read "count" consecutive disk sectors into a buffer.  Return only
+//	after the data has been read.
+//
+//	Cached sectors are copied from the cache.  Each run of sectors
+//	that are not cached is read with a single disk request, straight
+//	into "data", and copied from there into freshly recycled cache
+//	slots.  If a sector's slot is pending, we wait for its request and
+//	then look again.
+//
+//	"sectorNumber" -- the first disk sector to read
+//	"data" -- the buffer to hold the contents of the disk sectors
+//	"count" -- the number of sectors
+//----------------------------------------------------------------------
+
+void SynchDisk::ReadSectors(int sectorNumber, char *data, int count) {
+    CacheEntry *entry;
+    DiskRequest *req;
+    int i = 0;
+
+    ASSERT(sectorNumber >= 0 && count >= 0 && sectorNumber + count <= NumSectors);
+    lock->Acquire();
+    while (i < count) {
+        entry = Lookup(sectorNumber + i);
+        if (entry != NULL && entry->pending) {
+            WaitForIO();
+        } else if (entry != NULL) {
+            kernel->stats->numCacheHits++;
+            if (entry->prefetched) {
+                kernel->stats->numReadAheadHits++;
+                entry->prefetched = FALSE;
+            }
+            Touch(entry);
+            bcopy(entry->data, data + i * SectorSize, SectorSize);
+            i++;
+        } else if ((req = Reserve(sectorNumber + i, count - i, &data[i * SectorSize])) == NULL) {
+            WaitForIO();  // every slot is busy
+        } else {
+            kernel->stats->numCacheMisses += req->count;
+            Submit(req);
+            while (!req->done)
+                WaitForIO();
+            i += req->count;
+            delete req;
+        }
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteSectors
+// 	Write a buffer into "count" consecutive disk sectors.  Return only
+//	after the data has been written.
+//
+//	The new contents go into the cache and are marked dirty; since
+//	whole sectors are overwritten, a miss does not read the disk.
+//	A pending slot is waited for first, so that a read completing
+//	later cannot overwrite the new data.  A writer that is evicting
+//	dirty sectors faster than the disk can take them also waits,
+//	once MaxQueued requests are queued.  If we wake up the flusher,
+//	we give it the CPU right away, so that it can start writing back
+//	while we go on filling the cache.
+//
+//	While an operation is in progress, or if the sector is in the
+//	journal already, it is logged rather than dirty.  If JournalMax
+//	sectors are logged already, they are committed first.
+//
+//	"sectorNumber" -- the first disk sector to be written
+//	"data" -- the new contents of the disk sectors
+//	"count" -- the number of sectors
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteSectors(int sectorNumber, char *data, int count) {
+    CacheEntry *entry;
+    bool woke, logging;
+    int i = 0;
+
+    ASSERT(sectorNumber >= 0 && count >= 0 && sectorNumber + count <= NumSectors);
+    lock->Acquire();
+    while (i < count) {
+        if ((int)queue->NumInList() >= MaxQueued) {
+            WaitForIO();  // let the disk catch up with evictions
+            continue;
+        }
+        logging = journal != NULL &&
+                  (journal->Active() || journal->Logged(sectorNumber + i));
+        entry = Lookup(sectorNumber + i);
+        if (logging && numLogged >= JournalMax && (entry == NULL || !entry->logged)) {
+            CommitLogged();  // no room for more
+            continue;
+        }
+        if (entry == NULL)
+            entry = Replace(sectorNumber + i);
+        if (entry == NULL || entry->pending) {
+            WaitForIO();
+            continue;
+        }
+        bcopy(data + i * SectorSize, entry->data, SectorSize);
+        if (logging || entry->logged) {
+            if (!entry->logged) {
+                if (entry->dirty) {
+                    entry->dirty = FALSE;  // written back once committed
+                    numDirty--;
+                }
+                entry->logged = TRUE;
+                if (numLogged++ == 0)
+                    oldestLogged = kernel->stats->totalTicks;
+            }
+        } else if (!entry->dirty) {
+            entry->dirty = TRUE;
+            entry->dirtyTime = kernel->stats->totalTicks;
+            if (numDirty++ == 0)
+                oldestDirty = entry->dirtyTime;
+        }
+        Touch(entry);
+        i++;
+    }
+    woke = KickFlusher();
+    lock->Release();
+    if (woke)
+        kernel->currentThread->Yield();  // let the flusher start writing
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Prefetch
+// 	Start reading sectors into the cache that are likely to be read
+//	soon, and return without waiting for them.  This is only a hint:
+//	sectors that are already cached are not read again (the request
+//	stops at the first one after the start), and if no slot is free
+//	nothing is done.
+//
+//	"sectorNumber" -- the first disk sector to read
+//	"count" -- the number of consecutive sectors
+//----------------------------------------------------------------------
+
+void SynchDisk::Prefetch(int sectorNumber, int count) {
+    DiskRequest *req;
+
+    lock->Acquire();
+    count = min(count, MaxPrefetch);
+    while (count > 0 && Lookup(sectorNumber) != NULL) {
+        sectorNumber++;
+        count--;
+    }
+    if (count > 0 && (req = Reserve(sectorNumber, count, NULL)) != NULL) {
+        DEBUG(dbgDisk, "Prefetching " << req->count << " sectors from sector " << sectorNumber);
+        req->detached = TRUE;
+        for (CacheEntry *entry = req->slots; entry != NULL; entry = entry->ioNext)
+            entry->prefetched = TRUE;
+        kernel->stats->numReadAheads += req->count;
+        Submit(req);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Flush
+// 	Commit the logged sectors, write every dirty sector in the cache
+//	back to disk, and wait until it -- and any other request already
+//	queued -- is done.  This is what the Sync system call does.  Must
+//	be called from a thread, since it waits.
+//
+//	If another thread is in the middle of an operation, the logged
+//	sectors are only part of it, so they are left for Journal::End
+//	to commit when it is done.
+//----------------------------------------------------------------------
+
+void SynchDisk::Flush() {
+    lock->Acquire();
+    if (journal != NULL && journal->Active())
+        commitWanted = TRUE;
+    else
+        CommitLogged();
+    WriteDirty(kernel->stats->totalTicks, TRUE);
+    while (active != NULL)
+        WaitForIO();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteBehind
+// 	The flusher thread.  Each time KickFlusher wakes it up, commit
+//	the logged sectors if they have waited long enough, then start
+//	writing back the sectors that have been dirty too long -- or, if
+//	too many are dirty, all of them.  It does not wait for the writes,
+//	so it needs the CPU only briefly; and by the time the LRU slots
+//	are recycled, they are usually clean.
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteBehind() {
+    while (TRUE) {
+        flushWanted->P();
+        lock->Acquire();
+        if (CommitDue())
+            CommitLogged();
+        if (numDirty >= DirtyHigh)
+            WriteDirty(kernel->stats->totalTicks, FALSE);
+        else
+            WriteDirty((int)((unsigned)kernel->stats->totalTicks - DirtyExpire), FALSE);
+        flusherBusy = FALSE;
+        lock->Release();
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::IdleFlush
+// 	Commit the logged sectors, and write every dirty sector back to
+//	disk, while the machine is idle.
+//	Called (from Kernel::PrepareToEnd) with interrupts disabled,
+//	when no thread is ready to run.  We cannot block, so instead of
+//	waiting on the semaphore we let simulated time advance until
+//	the queue drains.
+//
+//	If a request is already outstanding, some thread is waiting for
+//	it and may still be using the cache; in that case do nothing.
+//	The last time through, when every thread has finished, this is
+//	what gets the cache contents onto the disk before we halt.
+//
+//	Since everything committed is then back home, the journal is
+//	emptied too, so that the next mount has nothing to replay.  But
+//	if a thread is blocked in the middle of an operation, its logged
+//	sectors are neither committed nor dropped from the journal.
+//----------------------------------------------------------------------
+
+void SynchDisk::IdleFlush() {
+    CacheEntry *dirtyList[CacheSize];
+    int n, run;
+
+    ASSERT(kernel->interrupt->getLevel() == IntOff);
+    if (active != NULL)
+        return;
+
+    if (journal != NULL && !journal->Active())
+        CommitLogged();
+    n = SortDirty(dirtyList, kernel->stats->totalTicks);
+    if (n > 0) {
+        DEBUG(dbgDisk, "Idle flush of " << n << " dirty sectors");
+    }
+    for (int i = 0; i < n; i += run) {
+        run = RunLength(&dirtyList[i], n - i);
+        Submit(Gather(&dirtyList[i], run, TRUE));
+    }
+    while (active != NULL)
+        kernel->interrupt->Idle();  // run until the writes complete
+    if (journal != NULL && !journal->Empty() && numLogged == 0)
+        Checkpoint();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::SetJournal
+// 	From now on, log the sectors written while an operation is in
+//	progress, and commit them to "j".  Called by the file system once
+//	the journal has been formatted or recovered.
+//----------------------------------------------------------------------
+
+void SynchDisk::SetJournal(Journal *j) {
+    journal = j;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Commit
+// 	Commit the logged sectors to the journal as one group, if there
+//	are at least JournalBatch of them, "force" is set, or Flush was
+//	called while the operation was in progress; otherwise leave them
+//	for the flusher, which commits them once they have waited
+//	CommitExpire ticks.  Called when the last operation in progress
+//	ends.
+//----------------------------------------------------------------------
+
+void SynchDisk::Commit(bool force) {
+    lock->Acquire();
+    if (force || commitWanted || numLogged >= JournalBatch)
+        CommitLogged();
     lock->Release();
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// 	Disk interrupt handler.  Complete the request the disk just
+//	finished, start the next one, and wake up every waiting thread
+//	to see whether what it was waiting for is done.  This is also
+//	a good time to see whether the flusher has work to do.
 //----------------------------------------------------------------------
 
 void SynchDisk::CallBack() {
-    semaphore->V();
+    DiskRequest *req = active;
+
+    active = NULL;
+    Finish(req);
+    StartNext();
+    for (; numWaiters > 0; numWaiters--)
+        ioDone->V();
+    KickFlusher();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Submit
+// 	Add a request to the queue, and start it right away if the disk
+//	is idle.
+//----------------------------------------------------------------------
+
+void SynchDisk::Submit(DiskRequest *req) {
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    queue->Append(req);
+    if (active == NULL)
+        StartNext();
+    (void)kernel->interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartNext
+// 	Send the next queued request, if any, to the disk.  Called with
+//	interrupts off, when the disk is idle.
+//----------------------------------------------------------------------
+
+void SynchDisk::StartNext() {
+    ASSERT(active == NULL);
+    if (queue->IsEmpty())
+        return;
+    active = ChooseNext();
+    queue->Remove(active);
+    if (active->writing)
+        disk->WriteRequest(active->sector, active->buf, active->count);
+    else
+        disk->ReadRequest(active->sector, active->buf, active->count);
+    headSector = active->sector + active->count - 1;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ChooseNext
+// 	Pick the queued request to serve next:
+//	   FCFS -- the oldest one
+//	   SSTF -- the one whose track is nearest the head (oldest first,
+//		among equals)
+//	   CLOOK -- the lowest sector at or past the head; if there is
+//		none, start the sweep again from the lowest sector
+//	A request may not overtake an older one it overlaps, so that reads
+//	and writes of the same sector stay in order; in that case the
+//	older one goes first.
+//----------------------------------------------------------------------
+
+DiskRequest *SynchDisk::ChooseNext() {
+    ListIterator<DiskRequest *> iter(queue);
+    DiskRequest *best = NULL;
+    DiskRequest *lowest = NULL;
+    int headTrack = headSector / SectorsPerTrack;
+
+    for (; !iter.IsDone(); iter.Next()) {
+        DiskRequest *req = iter.Item();
+
+        if (schedule == DiskFCFS)
+            return req;
+        if (schedule == DiskSSTF) {
+            if (best == NULL || abs(req->sector / SectorsPerTrack - headTrack) <
+                                    abs(best->sector / SectorsPerTrack - headTrack))
+                best = req;
+        } else {
+            if (req->sector >= headSector && (best == NULL || req->sector < best->sector))
+                best = req;
+            if (lowest == NULL || req->sector < lowest->sector)
+                lowest = req;
+        }
+    }
+    if (best == NULL)
+        best = lowest;
+
+    for (bool moved = TRUE; moved;) {
+        moved = FALSE;
+        for (ListIterator<DiskRequest *> older(queue); older.Item() != best; older.Next()) {
+            if (older.Item()->Overlaps(best)) {
+                best = older.Item();  // it must go first
+                moved = TRUE;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Finish
+// 	Complete a request, at interrupt time: for a read, copy the data
+//	into its slots; either way the slots are no longer pending.
+//----------------------------------------------------------------------
+
+void SynchDisk::Finish(DiskRequest *req) {
+    int i = 0;
+
+    for (CacheEntry *entry = req->slots; entry != NULL; entry = entry->ioNext, i++) {
+        ASSERT(entry->pending && entry->sector == req->sector + i);
+        if (!req->writing)
+            bcopy(req->buf + i * SectorSize, entry->data, SectorSize);
+        entry->pending = FALSE;
+    }
+    req->done = TRUE;
+    if (req->detached)
+        delete req;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WaitForIO
+// 	Give up the lock until the next request completes, then get it
+//	back.  The caller looks again at whatever it was waiting for.
+//----------------------------------------------------------------------
+
+void SynchDisk::WaitForIO() {
+    ASSERT(active != NULL);  // or we would wait forever
+    numWaiters++;
+    lock->Release();
+    ioDone->P();
+    lock->Acquire();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::KickFlusher
+// 	Wake up the flusher thread if too many slots are dirty, or one
+//	has been dirty too long, or it is time to commit, unless it is
+//	already awake.  Called when a sector is written, and when a
+//	request completes.  Return TRUE if the flusher was woken up.
+//----------------------------------------------------------------------
+
+bool SynchDisk::KickFlusher() {
+    if (flusherBusy)
+        return FALSE;
+    if (CommitDue() ||
+        (numDirty > 0 && (numDirty >= DirtyHigh ||
+                          TicksBetween(oldestDirty, kernel->stats->totalTicks) >= DirtyExpire))) {
+        flusherBusy = TRUE;
+        flushWanted->V();
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteDirty
+// 	Write back every slot that became dirty no later than "before",
+//	one request per run of consecutive sectors.  Called with the lock
+//	held.
+//
+//	"wait" -- if TRUE, return only when the writes are done
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteDirty(int before, bool wait) {
+    CacheEntry *dirtyList[CacheSize];
+    DiskRequest *reqs[CacheSize];
+    int n, numReqs = 0;
+
+    n = SortDirty(dirtyList, before);
+    DEBUG(dbgDisk, "Writing back " << n << " dirty sectors");
+    for (int i = 0, run; i < n; i += run) {
+        run = RunLength(&dirtyList[i], n - i);
+        reqs[numReqs] = Gather(&dirtyList[i], run, !wait);
+        Submit(reqs[numReqs++]);  // a detached one may be gone already
+    }
+    for (int i = 0; wait && i < numReqs; i++) {
+        while (!reqs[i]->done)
+            WaitForIO();
+        delete reqs[i];
+    }
+
+    oldestDirty = kernel->stats->totalTicks;  // find the new oldest
+    for (int i = 0; i < CacheSize; i++)
+        if (cache[i].dirty && TicksBetween(cache[i].dirtyTime, oldestDirty) > 0)
+            oldestDirty = cache[i].dirtyTime;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WaitForDisk
+// 	Wait until some request completes, like WaitForIO, but keep the
+//	lock meanwhile.  Called with interrupts off, from IdleFlush,
+//	there is no thread to switch to; then let simulated time advance
+//	instead.
+//----------------------------------------------------------------------
+
+void SynchDisk::WaitForDisk() {
+    if (kernel->interrupt->getLevel() == IntOff) {
+        kernel->interrupt->Idle();
+    } else {
+        ASSERT(active != NULL);
+        numWaiters++;
+        ioDone->P();
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteThrough
+// 	Write "count" consecutive sectors straight to disk, and wait
+//	until they are there.  Used for the journal, which must reach
+//	the disk in order.  A cached copy of them is updated too.
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteThrough(int sectorNumber, char *data, int count) {
+    DiskRequest *req = new DiskRequest(sectorNumber, count, TRUE, FALSE, data);
+    CacheEntry *entry;
+
+    for (int i = 0; i < count; i++) {
+        entry = Lookup(sectorNumber + i);
+        if (entry != NULL && !entry->pending)
+            bcopy(data + i * SectorSize, entry->data, SectorSize);
+    }
+    Submit(req);
+    while (!req->done)
+        WaitForDisk();
+    delete req;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CommitDue
+// 	Return TRUE if the logged sectors have waited long enough, and no
+//	operation is in progress, so that the flusher should commit them.
+//----------------------------------------------------------------------
+
+bool SynchDisk::CommitDue() {
+    return numLogged > 0 && !journal->Active() &&
+           TicksBetween(oldestLogged, kernel->stats->totalTicks) >= CommitExpire;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CommitLogged
+// 	Write every logged slot to the journal as one group: first the
+//	group, then the sector that commits it.  From then on the slots
+//	are dirty, and written back like any other.  Called with the
+//	lock held, or from IdleFlush.
+//
+//	Once the log has no room left for the biggest group, write back
+//	everything that has been committed, and start the log over.  No
+//	slot is logged at that point, so every sector in the log is
+//	written back in its committed state.
+//----------------------------------------------------------------------
+
+void SynchDisk::CommitLogged() {
+    int homes[JournalMax];
+    char *data, *group;
+    int n = 0, length, where;
+
+    commitWanted = FALSE;
+    if (numLogged == 0)
+        return;
+
+    data = new char[numLogged * SectorSize];
+    for (int i = 0; i < CacheSize; i++) {
+        if (cache[i].logged) {
+            homes[n] = cache[i].sector;
+            bcopy(cache[i].data, &data[n * SectorSize], SectorSize);
+            n++;
+        }
+    }
+    ASSERT(n == numLogged);
+    length = journal->Length(n);
+    group = new char[length * SectorSize];
+    where = journal->Pack(group, homes, data, n);
+    WriteThrough(where, group, length - 1);
+    WriteThrough(where + length - 1, &group[(length - 1) * SectorSize], 1);
+    kernel->stats->numJournalGroups++;
+    kernel->stats->numJournalSectors += n;
+    delete[] group;
+    delete[] data;
+
+    for (int i = 0; i < CacheSize; i++) {
+        if (cache[i].logged) {
+            ASSERT(!cache[i].dirty && !cache[i].pending);
+            cache[i].logged = FALSE;
+            cache[i].dirty = TRUE;
+            cache[i].dirtyTime = kernel->stats->totalTicks;
+            if (numDirty++ == 0)
+                oldestDirty = cache[i].dirtyTime;
+        }
+    }
+    numLogged = 0;
+
+    if (!journal->Fits(journal->Length(JournalMax)))
+        Checkpoint();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Checkpoint
+// 	Write every dirty slot back, wait until it is on disk, and then
+//	empty the journal by writing its new header.
+//----------------------------------------------------------------------
+
+void SynchDisk::Checkpoint() {
+    char header[SectorSize];
+
+    DEBUG(dbgDisk, "Checkpointing the journal");
+    WriteDirty(kernel->stats->totalTicks, FALSE);
+    while (active != NULL)
+        WaitForDisk();
+    WriteThrough(journal->Restart(header), header, 1);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Reserve
+// 	Build a read request for the run of uncached sectors starting at
+//	"sectorNumber" (at most "count" of them), recycling a slot for
+//	each and marking it pending.  Return NULL if no slot is free.
+//
+//	"into" -- where the disk is to put the data, or NULL to give
+//		the request a buffer of its own
+//----------------------------------------------------------------------
+
+DiskRequest *SynchDisk::Reserve(int sectorNumber, int count, char *into) {
+    DiskRequest *req;
+    CacheEntry **last;
+    int n;
+
+    for (n = 0; n < count && Lookup(sectorNumber + n) == NULL; n++)
+        ;
+    req = new DiskRequest(sectorNumber, n, FALSE, FALSE, into);
+    last = &req->slots;
+    for (n = 0; n < req->count; n++) {
+        CacheEntry *entry = Replace(sectorNumber + n);
+        if (entry == NULL)
+            break;  // the rest will have to wait
+        entry->pending = TRUE;
+        Touch(entry);
+        entry->ioNext = NULL;
+        *last = entry;
+        last = &entry->ioNext;
+    }
+    if (n == 0) {
+        delete req;
+        return NULL;
+    }
+    req->count = n;
+    return req;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Lookup
+// 	Return the cache slot holding "sectorNumber", or NULL if the
+//	sector is not cached.
+//----------------------------------------------------------------------
+
+CacheEntry *SynchDisk::Lookup(int sectorNumber) {
+    CacheEntry *entry;
+
+    for (entry = buckets[sectorNumber % CacheBuckets]; entry != NULL;
+         entry = entry->hashNext)
+        if (entry->sector == sectorNumber)
+            return entry;
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Replace
+// 	Recycle the least recently used slot that is neither pending nor
+//	logged to hold "sectorNumber".  If the old contents are dirty, a
+//	write request is queued for them, and nobody waits for it.  The
+//	contents of the returned slot are undefined; the caller must fill
+//	them in.
+//
+//	Return NULL if every slot is pending or logged.
+//----------------------------------------------------------------------
+
+CacheEntry *SynchDisk::Replace(int sectorNumber) {
+    CacheEntry *entry;
+    CacheEntry **prev;
+
+    for (entry = lruTail; entry != NULL && (entry->pending || entry->logged);
+         entry = entry->lruPrev)
+        ;
+    if (entry == NULL)
+        return NULL;
+    if (entry->sector != -1) {
+        if (entry->dirty) {
+            DiskRequest *req = new DiskRequest(entry->sector, 1, TRUE, TRUE);
+            bcopy(entry->data, req->buf, SectorSize);
+            entry->dirty = FALSE;
+            numDirty--;
+            Submit(req);
+        }
+        for (prev = &buckets[entry->sector % CacheBuckets]; *prev != entry;
+             prev = &(*prev)->hashNext)
+            ;
+        *prev = entry->hashNext;  // take it off its old chain
+    }
+    entry->sector = sectorNumber;
+    entry->prefetched = FALSE;
+    entry->hashNext = buckets[sectorNumber % CacheBuckets];
+    buckets[sectorNumber % CacheBuckets] = entry;
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Touch
+// 	Move a slot to the front of the LRU list.
+//----------------------------------------------------------------------
+
+void SynchDisk::Touch(CacheEntry *entry) {
+    if (entry == lruHead)
+        return;
+    entry->lruPrev->lruNext = entry->lruNext;
+    if (entry == lruTail)
+        lruTail = entry->lruPrev;
+    else
+        entry->lruNext->lruPrev = entry->lruPrev;
+    entry->lruPrev = NULL;
+    entry->lruNext = lruHead;
+    lruHead->lruPrev = entry;
+    lruHead = entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::SortDirty
+// 	Fill "list" with the slots that became dirty no later than
+//	"before", in increasing sector order, and return how many there
+//	are.  Slots with a request in flight are left for next time.
+//----------------------------------------------------------------------
+
+int SynchDisk::SortDirty(CacheEntry **list, int before) {
+    int n = 0;
+
+    for (int i = 0; i < CacheSize; i++) {
+        if (cache[i].sector != -1 && cache[i].dirty && !cache[i].pending &&
+            TicksBetween(cache[i].dirtyTime, before) >= 0) {
+            int j = n++;
+            for (; j > 0 && list[j - 1]->sector > cache[i].sector; j--)
+                list[j] = list[j - 1];  // insertion sort
+            list[j] = &cache[i];
+        }
+    }
+    return n;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::RunLength
+// 	Return how many of the first "n" slots in "list" (sorted by
+//	sector) hold consecutive sectors.
+//----------------------------------------------------------------------
+
+int SynchDisk::RunLength(CacheEntry **list, int n) {
+    int run = 1;
+
+    while (run < n && list[run]->sector == list[0]->sector + run)
+        run++;
+    return run;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Gather
+// 	Build a write request for the first "n" slots in "list", which
+//	hold consecutive sectors.  Their contents are copied into the
+//	request; they are clean from now on, and pending until the
+//	request completes.
+//----------------------------------------------------------------------
+
+DiskRequest *SynchDisk::Gather(CacheEntry **list, int n, bool detached) {
+    DiskRequest *req = new DiskRequest(list[0]->sector, n, TRUE, detached);
+
+    for (int i = 0; i < n; i++) {
+        bcopy(list[i]->data, req->buf + i * SectorSize, SectorSize);
+        list[i]->dirty = FALSE;
+        list[i]->pending = TRUE;
+        numDirty--;
+        list[i]->ioNext = (i + 1 < n) ? list[i + 1] : NULL;
+    }
+    req->slots = list[0];
+    return req;
 }
@@ -13,8 +13,89 @@
 
 #include "callback.h"
 #include "disk.h"
+#include "list.h"
 #include "synch.h"
 
+class Journal;
+
+// Size of the sector buffer cache kept by SynchDisk.  The number of
+// hash buckets is prime so that sectors on the same track spread out.
+const int CacheSize = 512;     // number of sectors held in the cache
+const int CacheBuckets = 257;  // number of hash chains
+const int MaxPrefetch = CacheSize / 4;  // most sectors read ahead at once
+const int MaxQueued = 32;      // writers wait while this many requests
+                               // are queued for the disk
+
+// When the flusher thread writes dirty sectors back.  It wakes up when
+// this many sectors are dirty, and writes all of them; or when a sector
+// has been dirty this long, and writes those that have.
+const int DirtyHigh = CacheSize / 4;  // dirty sectors
+const int DirtyExpire = 100000;       // ticks
+
+// The order in which queued disk requests are sent to the disk.
+enum DiskSchedule {
+    DiskFCFS,   // first come, first served
+    DiskSSTF,   // shortest seek (from the current track) first
+    DiskCLOOK   // sweep towards higher sectors, then jump back
+};
+
+// The following class defines one slot of the sector buffer cache.
+// Each slot is on exactly one hash chain (if it holds a sector) and
+// on the LRU list.
+//
+// Internal data structures kept public so that SynchDisk can access
+// them directly.
+
+class CacheEntry {
+   public:
+    int sector;               // Disk sector held here, -1 if unused
+    bool dirty;               // Modified since it was last written?
+    int dirtyTime;            // When it became dirty, if it is
+    bool pending;             // Is a disk request for it in flight?
+    bool prefetched;          // Read ahead, and not used since?
+    bool logged;              // Changed, and waiting to be committed
+                              // to the journal before it may be
+                              // written back?
+    CacheEntry *hashNext;     // Next slot on the same hash chain
+    CacheEntry *ioNext;       // Next slot of the same disk request
+    CacheEntry *lruPrev;      // Neighbours on the LRU list;
+    CacheEntry *lruNext;      //   most recently used at the front
+    char data[SectorSize];    // Contents of the sector
+};
+
+// The following class defines one request waiting for (or being
+// served by) the disk: "count" consecutive sectors starting at
+// "sector", transferred through "buf".  For a read, the data is
+// copied into "slots" when the request completes; for a write, it was
+// copied out of them when the request was made.  A thread that waits
+// for its request may have it transfer straight to or from its own
+// buffer; otherwise the request has one of its own.
+//
+// A detached request has nobody waiting for it; it is deleted when it
+// completes.  Otherwise whoever made it waits until "done" is set,
+// then deletes it.
+
+class DiskRequest {
+   public:
+    DiskRequest(int sector, int count, bool writing, bool detached, char *data = NULL);
+    ~DiskRequest();
+
+    static void *operator new(size_t size);  // From a pool of them
+    static void operator delete(void *object);
+
+    bool Overlaps(DiskRequest *other);  // Any sector in common?
+
+    int sector;           // First sector
+    int count;            // Number of sectors
+    bool writing;         // Write request?
+    bool detached;        // Delete when done?
+    bool done;            // Has the disk finished it?
+    char *buf;            // The data, "count" sectors of it
+    bool ownBuf;          // Was "buf" allocated for the request?
+    CacheEntry *slots;    // Cache slot of the first sector, the
+                          // rest linked through ioNext; or NULL
+};
+
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
 // requests to read or write portions of the disk return immediately,
@@ -25,12 +106,33 @@
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
 // returning.
+//
+// Requests are served from a write-back buffer cache of recently used
+// sectors.  Modified sectors stay in the cache until they are evicted,
+// until Flush is called, or until the machine goes idle (IdleFlush).
+// When dirty sectors are flushed, consecutive ones go to the disk as
+// one request.
+//
+// A kernel thread, the flusher, writes dirty sectors back in the
+// background, so that they do not pile up until eviction time.
+//
+// Once the file system hands us its journal, sectors written while an
+// operation is in progress (or that are in the log already) are not
+// dirty but logged: they stay in the cache until Commit writes them to
+// the journal as a group, and only then become dirty.
+//
+// Requests that miss in the cache wait in a queue, and whenever the
+// disk is free the next one is picked according to the DiskSchedule.
+// A thread waiting for the disk does not hold the lock, so other
+// threads can use the cache and queue requests of their own meanwhile.
 
 class SynchDisk : public CallBackObj {
    public:
-    SynchDisk();   // Initialize a synchronous disk,
-                   // by initializing the raw Disk.
-    ~SynchDisk();  // De-allocate the synch disk data
+    SynchDisk(char *schedule);  // Initialize a synchronous disk,
+                                // by initializing the raw Disk.
+                                // "schedule" is "fcfs", "sstf" or
+                                // "clook" (the default, if NULL)
+    ~SynchDisk();               // De-allocate the synch disk data
 
     void ReadSector(int sectorNumber, char *data);
     // Read/write a disk sector, returning
@@ -40,16 +142,95 @@ class SynchDisk : public CallBackObj {
     // then wait until the request is done.
     void WriteSector(int sectorNumber, char *data);
 
+    void ReadSectors(int sectorNumber, char *data, int count);
+    void WriteSectors(int sectorNumber, char *data, int count);
+    // Same, for "count" consecutive sectors;
+    // uncached runs are read with a single
+    // disk request
+
+    void Prefetch(int sectorNumber, int count);
+    // Start reading "count" consecutive
+    // sectors into the cache, without
+    // waiting for them
+
+    void Flush();      // Write every dirty cached sector back
+                       // to disk, in sector order, and wait
+                       // for it to get there
+    void IdleFlush();  // Same, but called with interrupts off
+                       // when no thread is runnable
+
+    void SetJournal(Journal *j);  // Log metadata changes from now on
+    void Commit(bool force);      // Commit the logged sectors to the
+                                  // journal, if enough are waiting,
+                                  // or anyway if "force"
+
     void CallBack();  // Called by the disk device interrupt
                       // handler, to signal that the
                       // current disk operation is complete.
 
+    void WriteBehind();  // Body of the flusher thread
+
    private:
     Disk *disk;            // Raw disk device
-    Semaphore *semaphore;  // To synchronize requesting thread
-                           // with the interrupt handler
-    Lock *lock;            // Only one read/write request
-                           // can be sent to the disk at a time
+    Lock *lock;            // Protects the cache; not held while
+                           // waiting for the disk
+    Semaphore *ioDone;     // V'ed once for each waiting thread
+                           // whenever a request completes
+    int numWaiters;        // Threads waiting on ioDone
+
+    DiskSchedule schedule;        // Order to serve requests in
+    List<DiskRequest *> *queue;   // Requests not yet sent to the disk,
+                                  // in arrival order
+    DiskRequest *active;          // Request the disk is serving, if any
+    int headSector;               // Where the last request left the head
+
+    Semaphore *flushWanted;  // Wakes up the flusher thread
+    bool flusherBusy;        // Woken up, and not done yet?
+    int numDirty;            // Dirty slots
+    int oldestDirty;         // When the oldest of them became dirty
+                             // (or earlier)
+
+    Journal *journal;        // Where logged sectors are committed,
+                             // or NULL
+    int numLogged;           // Logged slots
+    int oldestLogged;        // When the first of them was logged
+    bool commitWanted;       // Flushed while an operation was in
+                             // progress; commit when it ends
+
+    CacheEntry *cache;                   // The cache slots
+    CacheEntry *buckets[CacheBuckets];   // Hash chains, by sector number
+    CacheEntry *lruHead;                 // Most recently used slot
+    CacheEntry *lruTail;                 // Least recently used slot
+
+    void Submit(DiskRequest *req);  // Queue a request
+    void StartNext();               // Send the next one to the disk
+    DiskRequest *ChooseNext();      // Pick it, by the schedule
+    void Finish(DiskRequest *req);  // Complete it, at interrupt time
+    void WaitForIO();               // Wait until some request completes
+    bool KickFlusher();             // Wake the flusher, if it is time
+    void WriteDirty(int before, bool wait);
+    // Write back what was dirtied by then
+    void WaitForDisk();             // Same, or if called with interrupts
+                                    // off, let time pass until then
+    void WriteThrough(int sectorNumber, char *data, int count);
+    // Write around the cache, and wait
+    bool CommitDue();               // Time for the flusher to commit?
+    void CommitLogged();            // Write the logged slots to the
+                                    // journal, and make them dirty
+    void Checkpoint();              // Write back everything committed,
+                                    // and empty the journal
+
+    DiskRequest *Reserve(int sectorNumber, int count, char *into);
+    // Slots for a read of uncached sectors
+    CacheEntry *Lookup(int sectorNumber);  // Find a cached sector
+    CacheEntry *Replace(int sectorNumber);  // Recycle the LRU slot
+    void Touch(CacheEntry *entry);          // Move to the LRU front
+    int SortDirty(CacheEntry **list, int before);
+    // Slots dirtied by then, by sector
+    int RunLength(CacheEntry **list, int n);  // # of consecutive sectors
+                                              // at the front of "list"
+    DiskRequest *Gather(CacheEntry **list, int n, bool detached);
+    // A write request for them
 };
 
 #endif  // SYNCHDISK_H
@@ -31,10 +31,8 @@ Bitmap::Bitmap(int numItems)
     {
         map[i] = 0; // initialize map to keep Purify happy
     }
-    for (i = 0; i < numBits; i++)
-    {
-        Clear(i);
-    }
+    numClear = numBits;
+    nextWord = 0;
 }
 
 //----------------------------------------------------------------------
@@ -58,7 +56,11 @@ void Bitmap::Mark(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] |= 1 << (which % BitsInWord);
+    if (!Test(which))
+    {
+        map[which / BitsInWord] |= 1 << (which % BitsInWord);
+        numClear--;
+    }
 
     ASSERT(Test(which));
 }
@@ -74,7 +76,14 @@ void Bitmap::Clear(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+    if (Test(which))
+    {
+        map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+        if (numClear++ == 0)
+        {
+            nextWord = which / BitsInWord; // the only free bit is here
+        }
+    }
 
     ASSERT(!Test(which));
 }
@@ -102,26 +111,73 @@ bool Bitmap::Test(int which) const
 
 //----------------------------------------------------------------------
 // Bitmap::FindAndSet
-// 	Return the number of the first bit which is clear.
+// 	Return the number of a bit which is clear.
 //	As a side effect, set the bit (mark it as in use).
 //	(In other words, find and allocate a bit.)
 //
+//	The search is next-fit: it starts at the word where the previous
+//	search succeeded and wraps around, so that successive calls do
+//	not rescan the full words in front of it.  Full words are skipped
+//	whole; in the first word with a clear bit, the lowest clear bit
+//	is found by counting trailing zeros of the complement.
+//
 //	If no bits are clear, return -1.
 //----------------------------------------------------------------------
 
 int Bitmap::FindAndSet()
 {
-    for (int i = 0; i < numBits; i++)
+    if (numClear == 0)
     {
-        if (!Test(i))
+        return -1;
+    }
+    for (int n = 0; n < numWords; n++)
+    {
+        int w = (nextWord + n) % numWords;
+
+        if (map[w] != ~0u)
         {
-            Mark(i);
-            return i;
+            int i = w * BitsInWord + __builtin_ctz(~map[w]);
+
+            if (i < numBits) // the last word may have unused bits
+            {
+                nextWord = w;
+                Mark(i);
+                return i;
+            }
         }
     }
     return -1;
 }
 
+//----------------------------------------------------------------------
+// Bitmap::FindAndSetNear
+// 	Like FindAndSet, but return the first clear bit at or after
+//	"goal", wrapping around to the start of the map if there is none,
+//	so that related items can be allocated close together.
+//
+//	If no bits are clear, return -1.
+//
+//	"goal" is where the search starts
+//----------------------------------------------------------------------
+
+int Bitmap::FindAndSetNear(int goal)
+{
+    int i;
+
+    ASSERT(goal >= 0 && goal < numBits);
+    if (numClear == 0)
+    {
+        return -1;
+    }
+    i = NextClear(goal);
+    if (i == numBits)
+    {
+        i = NextClear(0);
+    }
+    Mark(i);
+    return i;
+}
+
 //----------------------------------------------------------------------
 // Bitmap::NumClear
 // 	Return the number of clear bits in the bitmap.
@@ -130,16 +186,151 @@ int Bitmap::FindAndSet()
 
 int Bitmap::NumClear() const
 {
-    int count = 0;
+    return numClear;
+}
 
-    for (int i = 0; i < numBits; i++)
+//----------------------------------------------------------------------
+// Bitmap::NumClear(int, int)
+// 	Return the number of clear bits from "from" up to (not including)
+//	"to".  Both must be multiples of BitsInWord, or "to" the end of
+//	the map.
+//----------------------------------------------------------------------
+
+int Bitmap::NumClear(int from, int to) const
+{
+    int numSet = 0;
+
+    ASSERT(from % BitsInWord == 0 && (to % BitsInWord == 0 || to == numBits));
+    ASSERT(0 <= from && from <= to && to <= numBits);
+    for (int w = from / BitsInWord; w < divRoundUp(to, BitsInWord); w++)
     {
-        if (!Test(i))
+        numSet += __builtin_popcount(map[w]);
+    }
+    return (to - from) - numSet;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindRun
+// 	Look for "length" consecutive clear bits, for allocating a file's
+//	data contiguously.  Return the start of the first such run (first
+//	fit) and set "*runLength" to "length".  If there is no run that
+//	long, return the longest run there is instead, so that the caller
+//	can allocate piecewise.  The bits are left clear; the caller marks
+//	the ones it decides to use.
+//
+//	The search starts at "goal" and wraps around, so that the run is
+//	near "goal" if there is a long enough one there.
+//
+//	If no bits are clear, return -1.
+//
+//	"length" is the number of bits wanted
+//	"runLength" is set to the number of bits in the returned run
+//	"goal" is where the search starts
+//----------------------------------------------------------------------
+
+int Bitmap::FindRun(int length, int *runLength, int goal) const
+{
+    int bestStart = -1;
+    int bestLength = 0;
+    bool wrapped = (goal == 0);
+
+    ASSERT(length > 0 && goal >= 0 && goal < numBits);
+    for (int start = NextClear(goal); start < numBits || !wrapped;)
+    {
+        if (start >= numBits)
+        {
+            start = NextClear(0); // go on from the start of the map
+            wrapped = TRUE;
+            continue;
+        }
+        if (wrapped && goal > 0 && start >= goal)
+        {
+            break; // back where we started
+        }
+        int end = NextSet(start);
+
+        if (end - start >= length)
+        {
+            *runLength = length;
+            return start;
+        }
+        if (end - start > bestLength)
         {
-            count++;
+            bestStart = start;
+            bestLength = end - start;
         }
+        start = NextClear(end);
     }
-    return count;
+    *runLength = bestLength;
+    return bestStart;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::NextClear, Bitmap::NextSet
+// 	Return the number of the first clear (or set) bit at or after
+//	"from", or numBits if there is none.  Whole words that cannot
+//	contain the bit are skipped.
+//----------------------------------------------------------------------
+
+int Bitmap::NextClear(int from) const
+{
+    int w = from / BitsInWord;
+    unsigned int bits;
+
+    if (from >= numBits)
+    {
+        return numBits;
+    }
+    bits = ~map[w] & (~0u << (from % BitsInWord));
+    while (bits == 0)
+    {
+        if (++w == numWords)
+        {
+            return numBits;
+        }
+        bits = ~map[w];
+    }
+    return min(w * BitsInWord + __builtin_ctz(bits), numBits);
+}
+
+int Bitmap::NextSet(int from) const
+{
+    int w = from / BitsInWord;
+    unsigned int bits;
+
+    if (from >= numBits)
+    {
+        return numBits;
+    }
+    bits = map[w] & (~0u << (from % BitsInWord));
+    while (bits == 0)
+    {
+        if (++w == numWords)
+        {
+            return numBits;
+        }
+        bits = map[w];
+    }
+    return min(w * BitsInWord + __builtin_ctz(bits), numBits);
+}
+
+//----------------------------------------------------------------------
+// Bitmap::Recount
+// 	Recompute the number of clear bits from scratch.  Subclasses that
+//	fill in "map" directly (e.g. from disk) must call this afterwards.
+//	Bits past the end of the last word are assumed to be clear.
+//----------------------------------------------------------------------
+
+void Bitmap::Recount()
+{
+    int numSet = 0;
+
+    for (int i = 0; i < numWords; i++)
+    {
+        numSet += __builtin_popcount(map[i]);
+    }
+    numClear = numBits - numSet;
+    nextWord = 0;
 }
 
 //----------------------------------------------------------------------
@@ -180,17 +371,35 @@ void Bitmap::SelfTest()
     ASSERT(Test(0) && Test(31));
 
     ASSERT(FindAndSet() == 1);
+    ASSERT(NumClear() == numBits - 3);
+    ASSERT(FindRun(29, &i) == 2 && i == 29);   // fits between 1 and 31
+    ASSERT(FindRun(30, &i) == 32 && i == 30);  // does not
+    ASSERT(FindRun(4, &i, 40) == 40 && i == 4); // near the goal
     Clear(0);
     Clear(1);
     Clear(31);
+    ASSERT(NumClear() == numBits);
 
     for (i = 0; i < numBits; i++)
     {
         Mark(i);
     }
     ASSERT(FindAndSet() == -1); // bitmap should be full!
+    ASSERT(NumClear() == 0);
+    ASSERT(FindRun(1, &i) == -1);
+
+    Clear(numBits - 1); // search starts at the first bit freed in a
+    Clear(BitsInWord + 1); // full map, then must wrap around
+    ASSERT(FindAndSet() == numBits - 1);
+    ASSERT(FindAndSet() == BitsInWord + 1);
+    Clear(5);
+    Clear(BitsInWord + 5);
+    ASSERT(NumClear(0, BitsInWord) == 1);
+    ASSERT(FindAndSetNear(6) == BitsInWord + 5); // at or after the goal
+    ASSERT(FindAndSetNear(6) == 5);              // wrapping around
     for (i = 0; i < numBits; i++)
     {
         Clear(i);
     }
+    ASSERT(NumClear() == numBits);
 }
@@ -8,6 +8,10 @@
 //	The bitmap can be parameterized with with the number of bits being
 //	managed.
 //
+//	Searches look at a whole word at a time, skipping words with no
+//	clear bits, and start where the previous search left off.  The
+//	number of clear bits is kept up to date as bits change.
+//
 // Copyright (c) 1992-1996 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
@@ -35,15 +39,26 @@ class Bitmap
 public:
     Bitmap(int numItems); // Initialize a bitmap, with "numItems" bits
                           // initially, all bits are cleared.
-    ~Bitmap();            // De-allocate bitmap
+    virtual ~Bitmap();    // De-allocate bitmap
 
-    void Mark(int which);       // Set the "nth" bit
-    void Clear(int which);      // Clear the "nth" bit
+    virtual void Mark(int which);  // Set the "nth" bit
+    virtual void Clear(int which); // Clear the "nth" bit
     bool Test(int which) const; // Is the "nth" bit set?
     int FindAndSet();           // Return the # of a clear bit, and as a side
         // effect, set the bit.
         // If no bits are clear, return -1.
+    int FindAndSetNear(int goal); // Same, but the first clear bit at
+        // or after "goal", wrapping around
     int NumClear() const; // Return the number of clear bits
+    int NumClear(int from, int to) const; // ... between "from" and "to"
+    int FindRun(int length, int *runLength, int goal = 0) const;
+        // Return the start of the first run of
+        // "length" clear bits at or after
+        // "goal" (wrapping around), or failing
+        // that of the longest clear run; its
+        // length goes in "runLength".  The bits
+        // are not set.  If no bits are clear,
+        // return -1.
 
     void Print() const; // Print contents of bitmap
     void SelfTest();    // Test whether bitmap is working
@@ -55,6 +70,13 @@ protected:
                        //  multiple of the number of bits in
                        //  a word)
     unsigned int *map; // bit storage
+    int numClear;      // number of clear bits
+    int nextWord;      // word where the next search starts
+
+    void Recount();    // Recompute numClear, after "map" has
+                       // been overwritten directly
+    int NextClear(int from) const; // First clear/set bit at or after
+    int NextSet(int from) const;   // "from", or numBits if none
 };
 
 #endif // BITMAP_H
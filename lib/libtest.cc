@@ -83,3 +83,44 @@ LibSelfTest () {
     delete sortList;
     delete hashTable;
 }
+
+//----------------------------------------------------------------------
+// BitmapBenchmark
+//	Time the bitmap operations the file system leans on: filling an
+//	empty map one bit at a time, then freeing and re-allocating
+//	scattered bits in a nearly full map, asking for the free count
+//	each time as the file system does.
+//
+//	"numBits" is the size of the bitmap (e.g. the number of sectors
+//	on the disk).
+//----------------------------------------------------------------------
+
+void
+BitmapBenchmark(int numBits) {
+    Bitmap *map = new Bitmap(numBits);
+    int churn = numBits / 16;
+    double start, fill, reuse;
+    int i;
+
+    start = HostSeconds();
+    for (i = 0; i < numBits; i++) {
+	ASSERT(map->FindAndSet() == i);
+    }
+    fill = HostSeconds() - start;
+
+    RandomInit(1);
+    start = HostSeconds();
+    for (i = 0; i < churn; i++) {
+	map->Clear(RandomNumber() % numBits);
+	ASSERT(map->NumClear() >= 1);
+	ASSERT(map->FindAndSet() != -1);
+    }
+    reuse = HostSeconds() - start;
+    ASSERT(map->NumClear() == 0);
+
+    cout << "Bitmap benchmark, " << numBits << " bits:\n";
+    cout << "  fill:  " << numBits << " allocations in " << fill << " s\n";
+    cout << "  reuse: " << churn << " free/allocate pairs in " << reuse
+	 << " s\n";
+    delete map;
+}
@@ -11,5 +11,6 @@
 #include "copyright.h"
 
 extern void LibSelfTest();
+extern void BitmapBenchmark(int numBits);
 
 #endif // LIBTEST_H
@@ -0,0 +1,156 @@
+// pool.cc
+//	Routines to hand out objects of one size from slabs, and take
+//	them back.
+//
+//	The free list is kept in the free objects themselves, and each
+//	slab's link to the next in its first bytes, so that a pool needs
+//	no memory beyond its slabs.
+//
+//	NOTE: Mutual exclusion must be provided by the caller.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "pool.h"
+
+// Objects, and the link at the front of a slab, start at a multiple of
+// this many bytes, which suits any object.
+static const int PoolAlign = 8;
+
+Pool *Pool::allPools = NULL;
+
+//----------------------------------------------------------------------
+// Pool::Pool
+// 	Initialize an empty pool, and put it on the list of all of them.
+//	No slab is allocated until the first Get.
+//
+//	"name" says what the objects are, for Print
+//	"objectSize" is the number of bytes in an object
+//	"perSlab" is the number of objects to allocate at a time
+//----------------------------------------------------------------------
+
+Pool::Pool(const char *name, int objectSize, int perSlab)
+{
+    ASSERT(objectSize > 0 && perSlab > 0);
+    this->name = name;
+    this->objectSize = divRoundUp(max(objectSize, (int)sizeof(void *)), PoolAlign) * PoolAlign;
+    this->perSlab = perSlab;
+    slabs = NULL;
+    freeList = NULL;
+    numSlabs = numInUse = maxInUse = numGets = 0;
+    next = allPools;
+    allPools = this;
+}
+
+//----------------------------------------------------------------------
+// Pool::~Pool
+// 	De-allocate the slabs, and take the pool off the list.  Objects
+//	still in use go with them.
+//----------------------------------------------------------------------
+
+Pool::~Pool()
+{
+    Pool **p;
+
+    while (slabs != NULL)
+    {
+        char *slab = slabs;
+
+        slabs = *(char **)slab;
+        delete[] slab;
+    }
+    for (p = &allPools; *p != this; p = &(*p)->next)
+        ASSERT(*p != NULL);
+    *p = next;
+}
+
+//----------------------------------------------------------------------
+// Pool::Get
+// 	Hand out an object, the one put back last if there is one, and
+//	otherwise one from a new slab.  Its contents are whatever was
+//	there before.
+//----------------------------------------------------------------------
+
+void *Pool::Get()
+{
+    void *object;
+
+    if (freeList == NULL)
+        Grow();
+    object = freeList;
+    freeList = *(void **)object;
+    numGets++;
+    numInUse++;
+    maxInUse = max(maxInUse, numInUse);
+    return object;
+}
+
+//----------------------------------------------------------------------
+// Pool::Put
+// 	Take back an object handed out by Get.  Putting back NULL, as
+//	deleting it does, is allowed, and does nothing.
+//
+//	"object" is the object we are done with
+//----------------------------------------------------------------------
+
+void Pool::Put(void *object)
+{
+    if (object == NULL)
+        return;
+    ASSERT(numInUse > 0);
+    *(void **)object = freeList;
+    freeList = object;
+    numInUse--;
+}
+
+//----------------------------------------------------------------------
+// Pool::Grow
+// 	Allocate a slab, and put all of its objects on the free list, in
+//	order, so that they are handed out front to back.
+//----------------------------------------------------------------------
+
+void Pool::Grow()
+{
+    char *slab = new char[PoolAlign + perSlab * objectSize];
+
+    DEBUG(dbgFile, "Pool of " << name << ": slab " << numSlabs + 1);
+    *(char **)slab = slabs;
+    slabs = slab;
+    numSlabs++;
+    for (int i = perSlab - 1; i >= 0; i--)
+    {
+        void *object = slab + PoolAlign + i * objectSize;
+
+        *(void **)object = freeList;
+        freeList = object;
+    }
+}
+
+//----------------------------------------------------------------------
+// Pool::Print
+// 	Print how many objects are in use, the most there have been, how
+//	many slabs hold them, and how many times one was handed out.
+//----------------------------------------------------------------------
+
+void Pool::Print()
+{
+    printf("  %s: %d in use (at most %d), %d slabs of %d, %d allocated\n", name, numInUse,
+           maxInUse, numSlabs, perSlab, numGets);
+}
+
+//----------------------------------------------------------------------
+// Pool::PrintAll
+// 	Print every pool, if there are any.
+//----------------------------------------------------------------------
+
+void Pool::PrintAll()
+{
+    if (allPools == NULL)
+        return;
+    printf("Pools:\n");
+    for (Pool *p = allPools; p != NULL; p = p->next)
+        p->Print();
+}
@@ -0,0 +1,66 @@
+// pool.h
+//	Data structures for pools of objects of one size, handed out and
+//	taken back many times over, as file headers and index blocks are.
+//
+//	Objects are carved out of slabs, each big enough for a number of
+//	them, which are only given back when the pool is destroyed.  An
+//	object that is put back goes on a free list, and is the next one
+//	handed out, so that a program that keeps allocating and freeing
+//	the same kinds of objects stops calling the host allocator once
+//	it has as many slabs as it ever needs at one time.
+//
+//	A class usually gets its objects from a pool of its own by
+//	defining operator new and operator delete.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "copyright.h"
+#include "utility.h"
+
+// The following class defines a pool of objects of "objectSize"
+// bytes, allocated "perSlab" at a time.  It keeps count of how many
+// are in use, the most there have been at once, and how many were
+// handed out in all, so that the pools can be sized.
+//
+// Every pool is on a list, so that PrintAll can print them; pools are
+// meant to be static, and live as long as the program.
+
+class Pool
+{
+public:
+    Pool(const char *name, int objectSize, int perSlab);
+                            // Initialize an empty pool
+    ~Pool();                // De-allocate its slabs
+
+    void *Get();            // Hand out an object, uninitialized
+    void Put(void *object); // Take one back
+
+    void Print();           // Print how full the pool is
+    static void PrintAll(); // Print every pool
+
+private:
+    const char *name;   // What the objects are, for Print
+    int objectSize;     // Bytes per object, rounded up so that
+                        // every object is aligned
+    int perSlab;        // Objects in a slab
+    char *slabs;        // Slabs allocated, each linked to the
+                        // next through its first word
+    void *freeList;     // Objects put back, linked through
+                        // their first word
+    int numSlabs;       // Slabs allocated
+    int numInUse;       // Objects handed out, not put back
+    int maxInUse;       // The most there have been at once
+    int numGets;        // Calls to Get
+
+    Pool *next;             // Next pool on the list of all of them
+    static Pool *allPools;  // The list
+
+    void Grow();        // Add a slab's worth to the free list
+};
+
+#endif // POOL_H
@@ -149,6 +149,22 @@ UDelay(unsigned int useconds)
 
 }
 
+//----------------------------------------------------------------------
+// HostSeconds
+// 	Return the wall-clock time of the UNIX host, in seconds.  Only
+//	useful for measuring how long Nachos itself takes to do something
+//	(simulated time is kept in kernel->stats).
+//----------------------------------------------------------------------
+
+double
+HostSeconds()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
 //----------------------------------------------------------------------
 // Abort
 // 	Quit and drop core.
@@ -100,53 +100,61 @@ PrintSector(bool writing, int sector, char *data)
 
 //----------------------------------------------------------------------
 // Disk::ReadRequest/WriteRequest
-// 	Simulate a request to read/write a single disk sector
+// 	Simulate a request to read/write "count" consecutive disk sectors
 //	   Do the read/write immediately to the UNIX file
 //	   Set up an interrupt handler to be called later,
 //	      that will notify the caller when the simulator says
 //	      the operation has completed.
 //
 //	Note that a disk only allows an entire sector to be read/written,
-//	not part of a sector.
+//	not part of a sector.  A multi-sector request pays for positioning
+//	the head once, then streams the sectors as they pass under it.
 //
-//	"sectorNumber" -- the disk sector to read/write
+//	"sectorNumber" -- the first disk sector to read/write
 //	"data" -- the bytes to be written, the buffer to hold the incoming bytes
+//	"count" -- the number of sectors
 //----------------------------------------------------------------------
 
-void Disk::ReadRequest(int sectorNumber, char *data)
+void Disk::ReadRequest(int sectorNumber, char *data, int count)
 {
-    int ticks = ComputeLatency(sectorNumber, FALSE);
+    int ticks = ComputeLatency(sectorNumber, FALSE) + RunTime(sectorNumber, count);
 
     ASSERT(!active); // only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (count >= 1) && (sectorNumber + count <= NumSectors));
 
-    DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
+    DEBUG(dbgDisk, "Reading " << count << " sectors from sector " << sectorNumber);
     Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+    Read(fileno, data, SectorSize * count);
     if (debug->IsEnabled('d'))
-        PrintSector(FALSE, sectorNumber, data);
+        for (int i = 0; i < count; i++)
+            PrintSector(FALSE, sectorNumber + i, data + i * SectorSize);
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    kernel->stats->numSeekTracks +=
+        abs(sectorNumber / SectorsPerTrack - lastSector / SectorsPerTrack);
+    UpdateLast(sectorNumber + count - 1);
     kernel->stats->numDiskReads++;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
-void Disk::WriteRequest(int sectorNumber, char *data)
+void Disk::WriteRequest(int sectorNumber, char *data, int count)
 {
-    int ticks = ComputeLatency(sectorNumber, TRUE);
+    int ticks = ComputeLatency(sectorNumber, TRUE) + RunTime(sectorNumber, count);
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (count >= 1) && (sectorNumber + count <= NumSectors));
 
-    DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
+    DEBUG(dbgDisk, "Writing " << count << " sectors to sector " << sectorNumber);
     Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    WriteFile(fileno, data, SectorSize * count);
     if (debug->IsEnabled('d'))
-        PrintSector(TRUE, sectorNumber, data);
+        for (int i = 0; i < count; i++)
+            PrintSector(TRUE, sectorNumber + i, data + i * SectorSize);
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    kernel->stats->numSeekTracks +=
+        abs(sectorNumber / SectorsPerTrack - lastSector / SectorsPerTrack);
+    UpdateLast(sectorNumber + count - 1);
     kernel->stats->numDiskWrites++;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
@@ -189,6 +197,22 @@ int Disk::TimeToSeek(int newSector, int *rotation)
     return seek;
 }
 
+//----------------------------------------------------------------------
+// Disk::RunTime()
+//	Returns how much longer a request for "count" sectors takes than
+//	one for just the first of them: one sector time for each further
+//	sector, plus a one-track seek each time the run moves to the next
+//	track.
+//----------------------------------------------------------------------
+
+int Disk::RunTime(int newSector, int count)
+{
+    int endSector = newSector + count - 1;
+    int tracks = endSector / SectorsPerTrack - newSector / SectorsPerTrack;
+
+    return (count - 1) * RotationTime + tracks * SeekTime;
+}
+
 //----------------------------------------------------------------------
 // Disk::ModuloDiff()
 // 	Return number of sectors of rotational delay between target sector
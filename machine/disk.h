@@ -1,8 +1,9 @@
 // disk.h
 //	Data structures to emulate a physical disk.  A physical disk
-//	can accept (one at a time) requests to read/write a disk sector;
-//	when the request is satisfied, the CPU gets an interrupt, and
-//	the next request can be sent to the disk.
+//	can accept (one at a time) requests to read/write a disk sector,
+//	or a run of consecutive sectors; when the request is satisfied,
+//	the CPU gets an interrupt, and the next request can be sent to
+//	the disk.
 //
 //	Disk contents are preserved across machine crashes, but if
 //	a file system operation (eg, create a file) is in progress when the
@@ -62,12 +63,14 @@ class Disk : public CallBackObj {
                                 // when each request completes.
     ~Disk();                    // Deallocate the disk.
 
-    void ReadRequest(int sectorNumber, char *data);
-    // Read/write an single disk sector.
+    void ReadRequest(int sectorNumber, char *data, int count = 1);
+    // Read/write "count" consecutive
+    // disk sectors, starting at
+    // "sectorNumber".
     // These routines send a request to
     // the disk and return immediately.
     // Only one request allowed at a time!
-    void WriteRequest(int sectorNumber, char *data);
+    void WriteRequest(int sectorNumber, char *data, int count = 1);
 
     void CallBack();  // Invoked when disk request
                       // finishes. In turn calls, callWhenDone.
@@ -87,6 +90,8 @@ class Disk : public CallBackObj {
                                 // being loaded
 
     int TimeToSeek(int newSector, int *rotate);  // time to get to the new track
+    int RunTime(int newSector, int count);       // extra time for the rest
+                                                 // of a multi-sector request
     int ModuloDiff(int to, int from);            // # sectors between to and from
     void UpdateLast(int newSector);
 };
@@ -9,6 +9,7 @@
 
 #include "copyright.h"
 #include "debug.h"
+#include "pool.h"
 #include "stats.h"
 
 //----------------------------------------------------------------------
@@ -19,7 +20,11 @@
 Statistics::Statistics()
 {
     totalTicks = idleTicks = systemTicks = userTicks = 0;
-    numDiskReads = numDiskWrites = 0;
+    numDiskReads = numDiskWrites = numSeekTracks = 0;
+    numCacheHits = numCacheMisses = 0;
+    numReadAheads = numReadAheadHits = 0;
+    numDentryHits = numDentryMisses = 0;
+    numJournalGroups = numJournalSectors = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
 }
@@ -37,9 +42,24 @@ Statistics::Print()
 		cout << ", system " << systemTicks << ", user " << userTicks <<"\n";
     cout << "Disk I/O: reads " << numDiskReads;
 		cout << ", writes " << numDiskWrites << "\n";
+    cout << "Disk seeks: tracks " << numSeekTracks;
+		if (numDiskReads + numDiskWrites > 0)
+		    cout << ", average " << ((double)numSeekTracks / (numDiskReads + numDiskWrites)) << " per request";
+		cout << "\n";
+    cout << "Disk cache: hits " << numCacheHits;
+		cout << ", misses " << numCacheMisses << "\n";
+    cout << "Read-ahead: sectors " << numReadAheads << ", used " << numReadAheadHits;
+		if (numReadAheads > 0)
+		    cout << " (" << (100 * numReadAheadHits / numReadAheads) << "%)";
+		cout << "\n";
+    cout << "Name cache: hits " << numDentryHits;
+		cout << ", misses " << numDentryMisses << "\n";
+    cout << "Journal: groups " << numJournalGroups;
+		cout << ", sectors " << numJournalSectors << "\n";
 		cout << "Console I/O: reads " << numConsoleCharsRead;
     cout << ", writes " << numConsoleCharsWritten << "\n";
     cout << "Paging: faults " << numPageFaults << "\n";
     cout << "Network I/O: packets received " << numPacketsRecvd;
 		cout << ", sent " << numPacketsSent << "\n";
+    Pool::PrintAll();
 }
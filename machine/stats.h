@@ -30,6 +30,15 @@ class Statistics {
 
     int numDiskReads;		// number of disk read requests
     int numDiskWrites;		// number of disk write requests
+    int numSeekTracks;		// tracks the disk head moved across
+    int numCacheHits;		// sector reads found in the buffer cache
+    int numCacheMisses;		// sector reads that went to the disk
+    int numReadAheads;		// sectors prefetched by read-ahead
+    int numReadAheadHits;	// prefetched sectors that were then read
+    int numDentryHits;		// path names found in the dentry cache
+    int numDentryMisses;	// path names looked up in a directory
+    int numJournalGroups;	// groups committed to the journal
+    int numJournalSectors;	// sectors logged in them
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
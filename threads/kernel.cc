@@ -15,6 +15,8 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchdisk.h"
+#include "inode.h"
+#include "journal.h"
 #include "post.h"
 #include "synchconsole.h"
 
@@ -32,10 +34,16 @@ Kernel::Kernel(int argc, char **argv)
     consoleOut = NULL;         // default is stdout
 #ifndef FILESYS_STUB
     formatFlag = FALSE;
+    formatDirEntries = 0;       // 0 is the default; see superblock.h
+    formatJournalSize = 0;
+    formatBlockSectors = 0;
 #endif
     reliability = 1;            // network reliability, default is 1.0
     hostName = 0;               // machine id, also UNIX socket name
                                 // 0 is the default machine id
+    readAheadMax = 32;          // sectors; see OpenFile::ReadAhead
+    flatMapMax = 32768;         // sectors; see MapCursor
+    diskSchedule = NULL;        // default is C-LOOK
 								
 	// MP4 mod tag
 	execfileNum = 0; // dummy operation to keep valgrind happy
@@ -63,6 +71,21 @@ Kernel::Kernel(int argc, char **argv)
 #ifndef FILESYS_STUB
 		} else if (strcmp(argv[i], "-f") == 0) {
 	    	formatFlag = TRUE;
+        } else if (strcmp(argv[i], "-fd") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is int
+            formatDirEntries = atoi(argv[i + 1]);
+            ASSERT(formatDirEntries > 0);
+            i++;
+        } else if (strcmp(argv[i], "-fj") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is int
+            formatJournalSize = atoi(argv[i + 1]);
+            ASSERT(formatJournalSize >= JournalMinSize);
+            i++;
+        } else if (strcmp(argv[i], "-fb") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is int
+            formatBlockSectors = atoi(argv[i + 1]);
+            ASSERT(formatBlockSectors > 0);
+            i++;
 #endif
         } else if (strcmp(argv[i], "-n") == 0) {
             ASSERT(i + 1 < argc);   // next argument is float
@@ -72,14 +95,31 @@ Kernel::Kernel(int argc, char **argv)
             ASSERT(i + 1 < argc);   // next argument is int
             hostName = atoi(argv[i + 1]);
             i++;
+        } else if (strcmp(argv[i], "-ra") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is int
+            readAheadMax = atoi(argv[i + 1]);
+            ASSERT(readAheadMax >= 0);
+            i++;
+        } else if (strcmp(argv[i], "-map") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is int
+            flatMapMax = atoi(argv[i + 1]);
+            ASSERT(flatMapMax >= 0);
+            i++;
+        } else if (strcmp(argv[i], "-ds") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is a schedule name
+            diskSchedule = argv[i + 1];
+            i++;
         } else if (strcmp(argv[i], "-u") == 0) {
             cout << "Partial usage: nachos [-rs randomSeed]\n";
 	   		cout << "Partial usage: nachos [-s]\n";
             cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
 #ifndef FILESYS_STUB
 	    	cout << "Partial usage: nachos [-nf]\n";
+	    	cout << "Partial usage: nachos [-f [-fd #] [-fj #] [-fb #]]";
+	    	cout << " (-fj at least " << JournalMinSize << ")\n";
 #endif
             cout << "Partial usage: nachos [-n #] [-m #]\n";
+            cout << "Partial usage: nachos [-ra #] [-map #] [-ds fcfs|sstf|clook]\n";
 		}
     }
 }
@@ -109,11 +149,13 @@ Kernel::Initialize()
     machine = new Machine(debugUserProg);
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
-    synchDisk = new SynchDisk();    //
+    synchDisk = new SynchDisk(diskSchedule);
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
-    fileSystem = new FileSystem(formatFlag);
+    inodeTable = new InodeTable();
+    fileSystem = new FileSystem(formatFlag, formatDirEntries, formatJournalSize,
+                                formatBlockSectors);
 #endif // FILESYS_STUB
 
 	// MP4 mod tag
@@ -131,12 +173,16 @@ Kernel::Initialize()
 // 	Since Nachos does not disable Timer, Console after all threads complete,
 //	which will result in generating infinite interrupts. We manually disable timer,
 //	console, etc. after all threads complete.
+//
+//	This is also where the disk buffer cache gets written back: we are
+//	called whenever no thread is runnable, so use the idle time.
 //----------------------------------------------------------------------
 void
 Kernel::PrepareToEnd()
 {
 	alarm->Disable();
 	synchConsoleIn->Disable();
+	synchDisk->IdleFlush();
 }
 
 //----------------------------------------------------------------------
@@ -155,6 +201,9 @@ Kernel::~Kernel()
     delete synchConsoleOut;
     delete synchDisk;
     delete fileSystem;
+#ifndef FILESYS_STUB
+    delete inodeTable;
+#endif
 	
 	// Mp4 mod tag
 	/*
@@ -24,6 +24,7 @@ class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
+class InodeTable;
 
 
 
@@ -64,11 +65,16 @@ class Kernel {
     SynchConsoleInput *synchConsoleIn;
     SynchConsoleOutput *synchConsoleOut;
     SynchDisk *synchDisk;
+    InodeTable *inodeTable;     // headers of open files
     FileSystem *fileSystem;     
     PostOfficeInput *postOfficeIn;
     PostOfficeOutput *postOfficeOut;
 
     int hostName;               // machine identifier
+    int readAheadMax;           // largest read-ahead window, in
+                                // sectors (0 turns read-ahead off)
+    int flatMapMax;             // largest file, in sectors, whose
+                                // whole map an OpenFile copies
 
   private:
 
@@ -81,8 +87,15 @@ class Kernel {
     double reliability;         // likelihood messages are dropped
     char *consoleIn;            // file to read console input from
     char *consoleOut;           // file to send console output to
+    char *diskSchedule;         // order to serve disk requests in
 #ifndef FILESYS_STUB
     bool formatFlag;          // format the disk if this is true
+    int formatDirEntries;     // entries a new directory has room
+                              // for, if formatting (0 = default)
+    int formatJournalSize;    // sectors in the journal, if
+                              // formatting (0 = default)
+    int formatBlockSectors;   // sectors per block of file data,
+                              // if formatting (0 = default)
 #endif
 };
 
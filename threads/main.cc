@@ -4,10 +4,14 @@
 //
 // Usage: nachos -d <debugflags> -rs <random seed #>
 //              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
-//              -f -cp <unix file> <nachos file>
-//              -p <nachos file> -r <nachos file> -l -D
+//              -f -fd <directory entries> -fj <journal sectors>
+//              -fb <sectors per block>
+//              -cp <unix file> <nachos file>
+//              -p <nachos file> -r <nachos file> -l -D -df
+//              -spread <nachos directory>
 //              -n <network reliability> -m <machine id>
-//              -z -K -C -N
+//              -z -K -C -N -B -ra <read-ahead sectors>
+//              -map <sectors> -ds <fcfs|sstf|clook>
 //
 //    -d causes certain debugging messages to be printed (see debug.h)
 //    -rs causes Yield to occur at random (but repeatable) spots
@@ -18,17 +22,30 @@
 //    -co specify file for console output (stdout is the default)
 //    -n sets the network reliability
 //    -m sets this machine's host id (needed for the network)
+//    -ra sets the largest file read-ahead window, in sectors (0 = off)
+//    -map sets the largest file, in sectors, whose whole sector map an
+//        open file keeps a copy of (0 = none)
+//    -ds sets the order queued disk requests are served in (C-LOOK
+//        is the default)
 //    -K run a simple self test of kernel threads and synchronization
 //    -C run an interactive console test
 //    -N run a two-machine network test (see Kernel::NetworkTest)
+//    -B time the free-sector bitmap on a disk-sized map
 //
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
+//    -fd sets how many entries a new directory has room for, -fj how
+//    many sectors the journal takes (at least JournalMinSize, 135),
+//    and -fb how many sectors file data is allocated at a time, when
+//    formatting
 //    -cp copies a file from UNIX to Nachos
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
 //    -l lists the contents of the Nachos directory
 //    -D prints the contents of the entire file system
+//    -df prints how the disk is laid out, and how much of it is free
+//    -spread lists the files under a directory, with the disk tracks
+//        each one is spread over
 //
 //  Note: the file system flags are not used if the stub filesystem
 //        is being used
@@ -41,7 +58,9 @@
 #include "copyright.h"
 #undef MAIN
 
+#include "disk.h"
 #include "filesys.h"
+#include "libtest.h"
 #include "main.h"
 #include "openfile.h"
 #include "sysdep.h"
@@ -171,6 +190,7 @@ int main(int argc, char **argv) {
     bool threadTestFlag = false;
     bool consoleTestFlag = false;
     bool networkTestFlag = false;
+    bool bitmapBenchmarkFlag = false;
 #ifndef FILESYS_STUB
     char *copyUnixFileName = NULL;    // UNIX file to be copied into Nachos
     char *copyNachosFileName = NULL;  // name of copied file in Nachos
@@ -178,6 +198,7 @@ int main(int argc, char **argv) {
     char *removeFileName = NULL;
     bool dirListFlag = false;
     bool dumpFlag = false;
+    bool usageFlag = false;
     // MP4 mod tag
     char *createDirectoryName = NULL;
     char *listDirectoryName = NULL;
@@ -186,6 +207,7 @@ int main(int argc, char **argv) {
     bool recursiveRemoveFlag = false;
     bool showHeaderSize = false;
     char *showHeaderFileName = NULL;
+    char *spreadDirectoryName = NULL;
 #endif  // FILESYS_STUB
 
     // some command line arguments are handled here.
@@ -208,6 +230,8 @@ int main(int argc, char **argv) {
             consoleTestFlag = TRUE;
         } else if (strcmp(argv[i], "-N") == 0) {
             networkTestFlag = TRUE;
+        } else if (strcmp(argv[i], "-B") == 0) {
+            bitmapBenchmarkFlag = TRUE;
         }
 #ifndef FILESYS_STUB
         else if (strcmp(argv[i], "-cp") == 0) {
@@ -249,8 +273,14 @@ int main(int argc, char **argv) {
             createDirectoryName = argv[i + 1];
             mkdirFlag = true;
             i++;
+        } else if (strcmp(argv[i], "-spread") == 0) {
+            ASSERT(i + 1 < argc);
+            spreadDirectoryName = argv[i + 1];
+            i++;
         } else if (strcmp(argv[i], "-D") == 0) {
             dumpFlag = true;
+        } else if (strcmp(argv[i], "-df") == 0) {
+            usageFlag = true;
         } else if (strcmp(argv[i], "-bonus2") == 0) {
             ASSERT(i + 1 < argc);
             showHeaderSize = true;
@@ -260,11 +290,12 @@ int main(int argc, char **argv) {
         else if (strcmp(argv[i], "-u") == 0) {
             cout << "Partial usage: nachos [-z -d debugFlags]\n";
             cout << "Partial usage: nachos [-x programName]\n";
-            cout << "Partial usage: nachos [-K] [-C] [-N]\n";
+            cout << "Partial usage: nachos [-K] [-C] [-N] [-B]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
             cout << "Partial usage: nachos [-p fileName] [-r fileName]\n";
-            cout << "Partial usage: nachos [-l] [-D]\n";
+            cout << "Partial usage: nachos [-l] [-D] [-df]\n";
+            cout << "Partial usage: nachos [-spread dirName]\n";
 #endif  // FILESYS_STUB
         }
     }
@@ -289,6 +320,9 @@ int main(int argc, char **argv) {
     if (networkTestFlag) {
         kernel->NetworkTest();  // two-machine test of the network
     }
+    if (bitmapBenchmarkFlag) {
+        BitmapBenchmark(NumSectors);  // time the free-sector bitmap
+    }
 
 #ifndef FILESYS_STUB
     if (removeFileName != NULL) {
@@ -303,6 +337,9 @@ int main(int argc, char **argv) {
     if (dumpFlag) {
         kernel->fileSystem->Print();
     }
+    if (usageFlag) {
+        kernel->fileSystem->PrintUsage();
+    }
     if (dirListFlag) {
         if (recursiveListFlag)
             kernel->fileSystem->RecursiveList(listDirectoryName);
@@ -319,6 +356,9 @@ int main(int argc, char **argv) {
     if (showHeaderSize) {
         kernel->fileSystem->PrintFileHdrSize(showHeaderFileName);
     }
+    if (spreadDirectoryName != NULL) {
+        kernel->fileSystem->PrintSpread(spreadDirectoryName);
+    }
 #endif  // FILESYS_STUB
 
     // finally, run an initial user program if requested to do so
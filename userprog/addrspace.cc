@@ -77,17 +77,23 @@ AddrSpace::AddrSpace()
 	pageTable[i].readOnly = FALSE;  
     }
     
+    for (int i = 0; i < MaxOpenFiles; i++)
+	openFiles[i] = NULL;
+
     // zero out the entire address space
     bzero(kernel->machine->mainMemory, MemorySize);
 }
 
 //----------------------------------------------------------------------
 // AddrSpace::~AddrSpace
-// 	Dealloate an address space.
+// 	Dealloate an address space, closing any files the program
+//	left open.
 //----------------------------------------------------------------------
 
 AddrSpace::~AddrSpace()
 {
+   for (int i = 0; i < MaxOpenFiles; i++)
+	delete openFiles[i];
    delete pageTable;
 }
 
@@ -314,3 +320,53 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
 
 
 
+
+//----------------------------------------------------------------------
+// AddrSpace::AddOpenFile
+// 	Put an open file in the lowest free slot of the descriptor
+//	table, and return the slot number as its OpenFileId.  Return -1
+//	if the program already has MaxOpenFiles files open.
+//
+//	"file" -- the file, which now belongs to this address space
+//----------------------------------------------------------------------
+
+OpenFileId
+AddrSpace::AddOpenFile(OpenFile *file)
+{
+    for (int id = 0; id < MaxOpenFiles; id++) {
+	if (openFiles[id] == NULL) {
+	    openFiles[id] = file;
+	    return id;
+	}
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::GetOpenFile
+// 	Return the file open as "id", or NULL if "id" is not in use.
+//----------------------------------------------------------------------
+
+OpenFile *
+AddrSpace::GetOpenFile(OpenFileId id)
+{
+    if (id < 0 || id >= MaxOpenFiles)
+	return NULL;
+    return openFiles[id];
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::RemoveOpenFile
+// 	Free descriptor "id", and return the file that was open as "id"
+//	(NULL if none was).  The caller closes the file.
+//----------------------------------------------------------------------
+
+OpenFile *
+AddrSpace::RemoveOpenFile(OpenFileId id)
+{
+    OpenFile *file = GetOpenFile(id);
+
+    if (file != NULL)
+	openFiles[id] = NULL;
+    return file;
+}
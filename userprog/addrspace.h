@@ -17,6 +17,7 @@
 #include "filesys.h"
 
 #define UserStackSize		1024 	// increase this as necessary!
+#define MaxOpenFiles		32	// files a program can have open
 
 class AddrSpace {
   public:
@@ -39,11 +40,18 @@ class AddrSpace {
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
+    OpenFileId AddOpenFile(OpenFile *file);	// Give "file" a descriptor;
+					// -1 if too many are open
+    OpenFile *GetOpenFile(OpenFileId id);	// File open as "id", or NULL
+    OpenFile *RemoveOpenFile(OpenFileId id);	// Same, and free "id"
+
   private:
     TranslationEntry *pageTable;	// Assume linear page table translation
 					// for now!
     unsigned int numPages;		// Number of pages in the virtual 
 					// address space
+    OpenFile *openFiles[MaxOpenFiles];	// Files the program has open,
+					// by OpenFileId
 
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
@@ -13,11 +13,17 @@
 
 #include "kernel.h"
 #include "synchconsole.h"
+#include "synchdisk.h"
 
 void SysHalt() {
+    kernel->synchDisk->Flush();  // don't lose cached writes
     kernel->interrupt->Halt();
 }
 
+void SysSync() {
+    kernel->synchDisk->Flush();
+}
+
 int SysAdd(int op1, int op2) {
     return op1 + op2;
 }
@@ -64,20 +70,44 @@ int SysCreate(char *filename, int size) {
     return kernel->fileSystem->Create(filename, size);
 }
 
+// Open files are kept in the descriptor table of the address space
+// of the program that opened them.
+
 OpenFileId SysOpen(char *filename) {
-    return kernel->fileSystem->OpenAFile(filename);
+    OpenFile *file = kernel->fileSystem->Open(filename);
+    OpenFileId id;
+
+    if (file == NULL)
+        return -1;
+    id = kernel->currentThread->space->AddOpenFile(file);
+    if (id == -1)
+        delete file;  // too many open files
+    return id;
 }
 
 int SysWrite(char *buffer, int size, OpenFileId id) {
-    return kernel->fileSystem->WriteFile(buffer, size, id);
+    OpenFile *file = kernel->currentThread->space->GetOpenFile(id);
+
+    if (file == NULL)
+        return -1;
+    return file->Write(buffer, size);
 }
 
 int SysRead(char *buffer, int size, OpenFileId id) {
-    return kernel->fileSystem->ReadFile(buffer, size, id);
+    OpenFile *file = kernel->currentThread->space->GetOpenFile(id);
+
+    if (file == NULL)
+        return -1;
+    return file->Read(buffer, size);
 }
 
 int SysClose(OpenFileId id) {
-    return kernel->fileSystem->CloseFile(id);
+    OpenFile *file = kernel->currentThread->space->RemoveOpenFile(id);
+
+    if (file == NULL)
+        return -1;
+    delete file;
+    return 1;
 }
 #endif
 
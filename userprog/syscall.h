@@ -34,6 +34,7 @@
 #define SC_ExecV 13
 #define SC_ThreadExit 14
 #define SC_ThreadJoin 15
+#define SC_Sync 16
 #define SC_Add 42
 #define SC_MSG 100
 
@@ -149,6 +150,11 @@ int Seek(int position, OpenFileId id);
  */
 int Close(OpenFileId id);
 
+/* Write every file system change made so far to the disk, and return
+ * once it is there.  Writes are otherwise cached for a while.
+ */
+void Sync();
+
 /* User-level thread operations: Fork and Yield.  To allow multiple
  * threads to run within a user program.
  *